@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+
+namespace bimap_impl {
+  // Layout written by bimap::save: the header, the left keys in order, each
+  // with the position of its pair among the right keys, then the right keys
+  // in order, each with the position of its pair among the left keys. There
+  // are only offsets and positions in it, so it can be read wherever it is
+  // placed in memory, but keys are stored as they are in memory, so it is only
+  // readable on a machine with the same byte order and type layouts.
+  struct file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t left_size;
+    uint32_t left_align;
+    uint32_t right_size;
+    uint32_t right_align;
+    uint64_t count;
+    uint64_t left_offset;
+    uint64_t right_offset;
+    uint64_t file_size;
+  };
+
+  template <typename Key>
+  struct file_record {
+    Key key;
+    uint64_t position;
+  };
+
+  inline constexpr char file_magic[8] = {'b', 'i', 'm', 'a', 'p', '\0', '\0', '\0'};
+  inline constexpr uint32_t file_version = 1;
+  inline constexpr uint32_t file_byte_order = 0x01020304;
+
+  constexpr uint64_t align_offset(uint64_t offset, uint64_t alignment) noexcept {
+    return (offset + alignment - 1) / alignment * alignment;
+  }
+
+  template <typename Key>
+  constexpr bool is_file_key_v = std::is_trivially_copyable_v<Key> && std::is_default_constructible_v<Key>;
+
+  template <typename Left, typename Right>
+  file_header make_file_header(uint64_t count) noexcept {
+    static_assert(is_file_key_v<Left> && is_file_key_v<Right>,
+                  "keys must be trivially copyable and default constructible");
+    file_header header{};
+    std::memcpy(header.magic, file_magic, sizeof(file_magic));
+    header.version = file_version;
+    header.byte_order = file_byte_order;
+    header.left_size = sizeof(Left);
+    header.left_align = alignof(Left);
+    header.right_size = sizeof(Right);
+    header.right_align = alignof(Right);
+    header.count = count;
+    header.left_offset = align_offset(sizeof(file_header), alignof(file_record<Left>));
+    header.right_offset = align_offset(header.left_offset + count * sizeof(file_record<Left>),
+                                       alignof(file_record<Right>));
+    header.file_size = header.right_offset + count * sizeof(file_record<Right>);
+    return header;
+  }
+
+  // Throws std::runtime_error unless the header was written for these key
+  // types on a compatible machine and its data fits in size bytes.
+  template <typename Left, typename Right>
+  void check_file_header(file_header const& header,
+                         uint64_t size = std::numeric_limits<uint64_t>::max()) {
+    if (std::memcmp(header.magic, file_magic, sizeof(file_magic)) != 0) {
+      throw std::runtime_error("not a bimap file");
+    }
+    if (header.version != file_version || header.byte_order != file_byte_order) {
+      throw std::runtime_error("unsupported bimap file version or byte order");
+    }
+    if (header.count > size / (sizeof(file_record<Left>) + sizeof(file_record<Right>))) {
+      throw std::runtime_error("truncated bimap file");
+    }
+    file_header expected = make_file_header<Left, Right>(header.count);
+    if (std::memcmp(&header, &expected, sizeof(file_header)) != 0) {
+      throw std::runtime_error("bimap file written for other key types");
+    }
+    if (header.file_size > size) {
+      throw std::runtime_error("truncated bimap file");
+    }
+  }
+
+  inline void write_padding(std::ostream& out, uint64_t count) {
+    static constexpr char zeros[64] = {};
+    for (; count > sizeof(zeros); count -= sizeof(zeros)) {
+      out.write(zeros, sizeof(zeros));
+    }
+    out.write(zeros, static_cast<std::streamsize>(count));
+  }
+
+  inline void read_exactly(std::istream& in, void* data, uint64_t size) {
+    in.read(static_cast<char*>(data), static_cast<std::streamsize>(size));
+    if (static_cast<uint64_t>(in.gcount()) != size) {
+      throw std::runtime_error("truncated bimap file");
+    }
+  }
+
+  inline void skip_exactly(std::istream& in, uint64_t size) {
+    in.ignore(static_cast<std::streamsize>(size));
+    if (static_cast<uint64_t>(in.gcount()) != size) {
+      throw std::runtime_error("truncated bimap file");
+    }
+  }
+}
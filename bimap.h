@@ -1,12 +1,25 @@
 #pragma once
 
+#include "bimap-file.h"
+#include "frozen-index.h"
 #include "tree.h"
+#include <algorithm>
+#include <cassert>
 #include <functional>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
+#include <vector>
 
 template <typename Left, typename Right,
           typename CompareLeft = std::less<Left>,
-          typename CompareRight = std::less<Right>>
+          typename CompareRight = std::less<Right>,
+          typename Allocator = std::allocator<std::pair<Left, Right>>>
 struct bimap {
 private:
   using left_t = Left;
@@ -17,6 +30,11 @@ private:
   using left_node_t = bimap_impl::tree_node<Left, bimap_impl::left_tag>;
   using right_node_t = bimap_impl::tree_node<Right, bimap_impl::right_tag>;
   using node_base_t = bimap_impl::tree_base_node;
+  using node_allocator_t = typename std::allocator_traits<Allocator>::template rebind_alloc<bimap_node_t>;
+  using node_traits = std::allocator_traits<node_allocator_t>;
+
+  static_assert(std::is_same_v<typename node_traits::pointer, bimap_node_t*>,
+                "allocator must use raw pointers");
 
   template <typename Value, typename CompareValue, typename Tag,
             typename FlipValue, typename FlipCompareValue, typename FlipTag>
@@ -25,41 +43,74 @@ private:
 public:
   using left_iterator = base_iterator<Left, CompareLeft, bimap_impl::left_tag, Right, CompareRight, bimap_impl::right_tag>;
   using right_iterator = base_iterator<Right, CompareRight, bimap_impl::right_tag, Left, CompareLeft, bimap_impl::left_tag>;
+  using change_kind = bimap_impl::change_kind;
+
+  struct node_type;
 
   bimap(CompareLeft compare_left = CompareLeft(),
-        CompareRight compare_right = CompareRight())
+        CompareRight compare_right = CompareRight(),
+        Allocator const& allocator = Allocator())
       : left_tree(std::move(compare_left)),
-        right_tree(std::move(compare_right)) {
+        right_tree(std::move(compare_right)),
+        allocator(allocator) {
     left_tree.connect(right_tree);
   }
 
+  explicit bimap(Allocator const& allocator)
+      : bimap(CompareLeft(), CompareRight(), allocator) {}
+
+  template <typename InputIt, typename = bimap_impl::enable_if_pair_iterator_t<InputIt>>
+  bimap(InputIt first, InputIt last,
+        CompareLeft compare_left = CompareLeft(),
+        CompareRight compare_right = CompareRight(),
+        Allocator const& allocator = Allocator())
+      : bimap(std::move(compare_left), std::move(compare_right), allocator) {
+    insert(first, last);
+  }
+
   bimap(bimap const& other)
-      : bimap(other.left_tree.get_comparator(), other.right_tree.get_comparator()) {
-    for (left_iterator iter = other.begin_left(); iter != other.end_left(); ++iter) {
-      insert(*iter, *iter.flip());
-    }
+      : bimap(other, node_traits::select_on_container_copy_construction(other.allocator)) {}
+
+  bimap(bimap const& other, Allocator const& allocator)
+      : bimap(other.left_tree.get_comparator(), other.right_tree.get_comparator(), allocator) {
+    copy_from(other);
   }
 
-  bimap(bimap&& other) noexcept : bimap() {
-    other.swap(*this);
+  bimap(bimap&& other) noexcept
+      : bimap(CompareLeft(), CompareRight(), other.allocator) {
+    swap_nodes(other);
   }
 
+  // The allocators follow the propagate_on_container_* traits, as in the
+  // standard containers. A move between unequal allocators that stay put
+  // copies the pairs.
   bimap& operator=(bimap const& other) {
     if (this != &other) {
-      bimap(other).swap(*this);
+      bimap copy(other, node_traits::propagate_on_container_copy_assignment::value ? other.allocator : allocator);
+      swap_all(copy);
     }
     return *this;
   }
 
-  bimap& operator=(bimap&& other) noexcept {
-    if (this != &other) {
-      bimap(std::move(other)).swap(*this);
+  bimap& operator=(bimap&& other) noexcept(node_traits::propagate_on_container_move_assignment::value ||
+                                           node_traits::is_always_equal::value) {
+    if (this == &other) {
+      return *this;
     }
+    if constexpr (!node_traits::propagate_on_container_move_assignment::value) {
+      if (allocator != other.allocator) {
+        bimap copy(other, allocator);
+        swap_nodes(copy);
+        return *this;
+      }
+    }
+    bimap moved(std::move(other));
+    swap_all(moved);
     return *this;
   }
 
   ~bimap() {
-    erase_left(begin_left(), end_left());
+    clear();
   }
 
 
@@ -79,6 +130,125 @@ public:
     return insert_impl(std::move(left), std::move(right));
   }
 
+  // The pair is linked next to hint when it belongs right before or right
+  // after it, so inserting sorted input with the previous result or the end
+  // as a hint skips the descent in that tree.
+  left_iterator insert(left_iterator hint, left_t const& left, right_t const& right) {
+    return insert_impl(hint, right_iterator(), left, right);
+  }
+
+  left_iterator insert(left_iterator hint, left_t const& left, right_t&& right) {
+    return insert_impl(hint, right_iterator(), left, std::move(right));
+  }
+
+  left_iterator insert(left_iterator hint, left_t&& left, right_t const& right) {
+    return insert_impl(hint, right_iterator(), std::move(left), right);
+  }
+
+  left_iterator insert(left_iterator hint, left_t&& left, right_t&& right) {
+    return insert_impl(hint, right_iterator(), std::move(left), std::move(right));
+  }
+
+  left_iterator insert(right_iterator hint, left_t const& left, right_t const& right) {
+    return insert_impl(left_iterator(), hint, left, right);
+  }
+
+  left_iterator insert(right_iterator hint, left_t const& left, right_t&& right) {
+    return insert_impl(left_iterator(), hint, left, std::move(right));
+  }
+
+  left_iterator insert(right_iterator hint, left_t&& left, right_t const& right) {
+    return insert_impl(left_iterator(), hint, std::move(left), right);
+  }
+
+  left_iterator insert(right_iterator hint, left_t&& left, right_t&& right) {
+    return insert_impl(left_iterator(), hint, std::move(left), std::move(right));
+  }
+
+
+  // Inserts pairs (anything std::get<0> and std::get<1> apply to) with the
+  // same result as inserting them one by one. A pair is skipped when either of
+  // its keys already exists or is taken by an earlier pair of the range.
+  // Instead of descending the trees for every pair, the range is sorted by
+  // each side and both trees are rebuilt from the merged sorted sequences,
+  // unless the range is too small compared to the bimap for that to pay off.
+  // If an exception is thrown, the bimap is left unchanged.
+  template <typename InputIt, typename = bimap_impl::enable_if_pair_iterator_t<InputIt>>
+  void insert(InputIt first, InputIt last) {
+    std::vector<bimap_node_t*> nodes;
+    try {
+      for (; first != last; ++first) {
+        auto&& pair = *first;
+        nodes.push_back(nullptr);
+        nodes.back() = create_node(std::get<0>(std::forward<decltype(pair)>(pair)),
+                                   std::get<1>(std::forward<decltype(pair)>(pair)));
+      }
+      insert_nodes(nodes);
+    } catch (...) {
+      destroy_nodes(nodes);
+      throw;
+    }
+  }
+
+  // Same result as the range insert, but the range is read chunk_size pairs
+  // at a time and every chunk is linked before the next one is read, so the
+  // memory needed besides the nodes is bounded by the chunk and not by the
+  // input. Once the bimap is large compared to a chunk, pairs are linked one
+  // by one with the ends of the trees as hints, which appends input sorted
+  // by either side without descending that tree. If an exception is thrown,
+  // the chunks linked before it stay in the bimap.
+  template <typename InputIt, typename = bimap_impl::enable_if_pair_iterator_t<InputIt>>
+  void insert_stream(InputIt first, InputIt last, size_t chunk_size = stream_chunk) {
+    insert_chunks(chunk_size, [&](std::vector<bimap_node_t*>& nodes) {
+      if (first == last) {
+        return false;
+      }
+      auto&& pair = *first;
+      nodes.push_back(nullptr);
+      nodes.back() = create_node(std::get<0>(std::forward<decltype(pair)>(pair)),
+                                 std::get<1>(std::forward<decltype(pair)>(pair)));
+      ++first;
+      return true;
+    });
+  }
+
+  // Reads pairs as in >> left >> right until an extraction fails and inserts
+  // them like the iterator version. The state of in tells whether it stopped
+  // at the end of the input or at something that is not a pair.
+  template <typename L = left_t, typename R = right_t>
+  std::enable_if_t<std::is_default_constructible_v<L> && std::is_default_constructible_v<R>>
+  insert_stream(std::istream& in, size_t chunk_size = stream_chunk) {
+    insert_chunks(chunk_size, [&](std::vector<bimap_node_t*>& nodes) {
+      left_t left;
+      right_t right;
+      if (!(in >> left >> right)) {
+        return false;
+      }
+      nodes.push_back(nullptr);
+      nodes.back() = create_node(std::move(left), std::move(right));
+      return true;
+    });
+  }
+
+
+  // Constructs the pair in a new node from args, which are either the
+  // arguments for both sides or std::piecewise_construct and two tuples.
+  // The node is freed again if either side already exists.
+  template <typename... Args>
+  left_iterator emplace(Args&&... args) {
+    return insert_node(create_node(std::forward<Args>(args)...));
+  }
+
+  // Looks both keys up as they are and constructs the sides from them only
+  // when neither exists, so nothing is allocated or constructed otherwise.
+  // Keys of other types need a transparent comparator.
+  template <typename ArgLeft, typename ArgRight,
+            typename = std::enable_if_t<bimap_impl::is_key_v<ArgLeft, left_t, CompareLeft> &&
+                                        bimap_impl::is_key_v<ArgRight, right_t, CompareRight>>>
+  left_iterator try_emplace(ArgLeft&& left, ArgRight&& right) {
+    return insert_impl(std::forward<ArgLeft>(left), std::forward<ArgRight>(right));
+  }
+
 
   left_iterator erase_left(left_iterator it) {
     return remove(static_cast<bimap_node_t*>(
@@ -86,6 +256,12 @@ public:
   }
 
   bool erase_left(left_t const& left) {
+    return erase_left<left_t>(left);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft> &&
+                                                      !std::is_convertible_v<Key, left_iterator>>>
+  bool erase_left(Key const& left) {
     left_node_t* left_node = left_tree.find(left);
     if (left_node != nullptr) {
       remove(static_cast<bimap_node_t*>(left_node));
@@ -100,6 +276,12 @@ public:
   }
 
   bool erase_right(right_t const& right) {
+    return erase_right<right_t>(right);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight> &&
+                                                      !std::is_convertible_v<Key, right_iterator>>>
+  bool erase_right(Key const& right) {
     right_node_t* right_node = right_tree.find(right);
     if (right_node != nullptr) {
       remove(static_cast<bimap_node_t*>(right_node));
@@ -127,7 +309,147 @@ public:
   }
 
 
+  // Unlinks the pair and hands its node over instead of freeing it, so it
+  // can be inserted into this or another bimap with an equal allocator
+  // without allocating or copying the keys.
+  node_type extract_left(left_iterator it) {
+    bimap_node_t* bimap_node = static_cast<bimap_node_t*>(static_cast<left_node_t*>(it.src_node));
+    unlink(bimap_node);
+    return node_type(bimap_node, allocator);
+  }
+
+  node_type extract_left(left_t const& left) {
+    return extract_left<left_t>(left);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft> &&
+                                                      !std::is_convertible_v<Key, left_iterator>>>
+  node_type extract_left(Key const& left) {
+    left_node_t* left_node = left_tree.find(left);
+    return left_node != nullptr ? extract_left(left_iterator(left_node)) : node_type();
+  }
+
+  node_type extract_right(right_iterator it) {
+    bimap_node_t* bimap_node = static_cast<bimap_node_t*>(static_cast<right_node_t*>(it.src_node));
+    unlink(bimap_node);
+    return node_type(bimap_node, allocator);
+  }
+
+  node_type extract_right(right_t const& right) {
+    return extract_right<right_t>(right);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight> &&
+                                                      !std::is_convertible_v<Key, right_iterator>>>
+  node_type extract_right(Key const& right) {
+    right_node_t* right_node = right_tree.find(right);
+    return right_node != nullptr ? extract_right(right_iterator(right_node)) : node_type();
+  }
+
+  // Links the pair owned by node and leaves node empty. If either key
+  // already exists, end_left() is returned and node keeps the pair.
+  left_iterator insert(node_type&& node) {
+    if (node.empty()) {
+      return end_left();
+    }
+    assert(*node.allocator == allocator);
+    bimap_impl::insert_position left_position = left_tree.find_position(node.left());
+    if (left_position.found != nullptr) {
+      return end_left();
+    }
+    bimap_impl::insert_position right_position = right_tree.find_position(node.right());
+    if (right_position.found != nullptr) {
+      return end_left();
+    }
+    return link_node(std::exchange(node.node, nullptr), left_position, right_position);
+  }
+
+  // Set operations with the pairs of other. A pair of other conflicts with
+  // this bimap if it shares a key with a pair here without being equal to
+  // it, and the overloads taking an output iterator write such pairs there
+  // as std::pair<left_t, right_t>, in no particular order. Unless other is
+  // small compared to this bimap, both are walked in lockstep in left and
+  // then in right order and both trees are rebuilt from the result, which
+  // takes O(n + m) instead of a lookup per pair.
+
+  // Moves the pairs of other whose keys are both free here by relinking
+  // their nodes, the rest stay in other. Nothing is allocated or copied, so
+  // the allocators have to be equal.
+  void merge(bimap& other) {
+    merge_impl(other, [](bimap_node_t*) {});
+  }
+
+  void merge(bimap&& other) {
+    merge(other);
+  }
+
+  template <typename OutputIt>
+  OutputIt merge(bimap& other, OutputIt conflicts) {
+    merge_impl(other, reporter(conflicts));
+    return conflicts;
+  }
+
+  // Adds copies of the pairs of other whose keys are both free here.
+  void unite(bimap const& other) {
+    unite_impl(other, [](bimap_node_t*) {});
+  }
+
+  template <typename OutputIt>
+  OutputIt unite(bimap const& other, OutputIt conflicts) {
+    unite_impl(other, reporter(conflicts));
+    return conflicts;
+  }
+
+  // Keeps only the pairs that other has too.
+  void intersect(bimap const& other) {
+    intersect_impl(other, [](bimap_node_t*) {});
+  }
+
+  template <typename OutputIt>
+  OutputIt intersect(bimap const& other, OutputIt conflicts) {
+    intersect_impl(other, reporter(conflicts));
+    return conflicts;
+  }
+
+  // Erases the pairs that other has too.
+  void subtract(bimap const& other) {
+    subtract_impl(other, [](bimap_node_t*) {});
+  }
+
+  template <typename OutputIt>
+  OutputIt subtract(bimap const& other, OutputIt conflicts) {
+    subtract_impl(other, reporter(conflicts));
+    return conflicts;
+  }
+
+
+  // Gives the pair a new key on one side in place: its node is moved within
+  // that side's tree only, nothing is allocated and iterators to the pair
+  // stay valid. If the key belongs to another pair, nothing changes and end
+  // is returned. If assigning or comparing the key throws, the pair is erased.
+  left_iterator replace_left(left_iterator it, left_t const& left) {
+    return left_iterator(replace_key<left_node_t>(left_tree, it.src_node, left));
+  }
+
+  left_iterator replace_left(left_iterator it, left_t&& left) {
+    return left_iterator(replace_key<left_node_t>(left_tree, it.src_node, std::move(left)));
+  }
+
+  right_iterator replace_right(right_iterator it, right_t const& right) {
+    return right_iterator(replace_key<right_node_t>(right_tree, it.src_node, right));
+  }
+
+  right_iterator replace_right(right_iterator it, right_t&& right) {
+    return right_iterator(replace_key<right_node_t>(right_tree, it.src_node, std::move(right)));
+  }
+
+
   left_iterator find_left(left_t const& left) const {
+    return find_left<left_t>(left);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+  left_iterator find_left(Key const& left) const {
     left_node_t* left_node = left_tree.find(left);
     if (left_node == nullptr) {
       return end_left();
@@ -136,6 +458,11 @@ public:
   }
 
   right_iterator find_right(right_t const& right) const {
+    return find_right<right_t>(right);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+  right_iterator find_right(Key const& right) const {
     right_node_t* right_node = right_tree.find(right);
     if (right_node == nullptr) {
       return end_right();
@@ -145,6 +472,11 @@ public:
 
 
   right_t const& at_left(left_t const& key) const {
+    return at_left<left_t>(key);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+  right_t const& at_left(Key const& key) const {
     left_node_t* left_node = left_tree.find(key);
     if (left_node == nullptr) {
       throw std::out_of_range("no entry exists");
@@ -153,6 +485,11 @@ public:
   }
 
   left_t const& at_right(right_t const& key) const {
+    return at_right<right_t>(key);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+  left_t const& at_right(Key const& key) const {
     right_node_t* right_node = right_tree.find(key);
     if (right_node == nullptr) {
       throw std::out_of_range("no entry exists");
@@ -161,6 +498,54 @@ public:
   }
 
 
+  // Look up every key of [first, last) and write the results to out in the
+  // same order. Searches of neighbouring keys are interleaved, which hides
+  // most of the memory latency of a loop over find_left and find_right.
+  template <typename ForwardIt, typename OutputIt,
+            typename = std::enable_if_t<bimap_impl::is_key_v<typename std::iterator_traits<ForwardIt>::value_type, left_t, CompareLeft>>>
+  OutputIt find_left_batch(ForwardIt first, ForwardIt last, OutputIt out) const {
+    left_tree.find_batch(first, last, [this, &out](left_node_t* left_node) {
+      *out++ = left_node == nullptr ? end_left() : left_iterator(static_cast<node_base_t*>(left_node));
+    });
+    return out;
+  }
+
+  template <typename ForwardIt, typename OutputIt,
+            typename = std::enable_if_t<bimap_impl::is_key_v<typename std::iterator_traits<ForwardIt>::value_type, right_t, CompareRight>>>
+  OutputIt find_right_batch(ForwardIt first, ForwardIt last, OutputIt out) const {
+    right_tree.find_batch(first, last, [this, &out](right_node_t* right_node) {
+      *out++ = right_node == nullptr ? end_right() : right_iterator(static_cast<node_base_t*>(right_node));
+    });
+    return out;
+  }
+
+  // Write the values paired with the keys of [first, last) to out, throwing
+  // std::out_of_range at the first missing key.
+  template <typename ForwardIt, typename OutputIt,
+            typename = std::enable_if_t<bimap_impl::is_key_v<typename std::iterator_traits<ForwardIt>::value_type, left_t, CompareLeft>>>
+  OutputIt at_left_batch(ForwardIt first, ForwardIt last, OutputIt out) const {
+    left_tree.find_batch(first, last, [&out](left_node_t* left_node) {
+      if (left_node == nullptr) {
+        throw std::out_of_range("no entry exists");
+      }
+      *out++ = switch_node(left_node)->value();
+    });
+    return out;
+  }
+
+  template <typename ForwardIt, typename OutputIt,
+            typename = std::enable_if_t<bimap_impl::is_key_v<typename std::iterator_traits<ForwardIt>::value_type, right_t, CompareRight>>>
+  OutputIt at_right_batch(ForwardIt first, ForwardIt last, OutputIt out) const {
+    right_tree.find_batch(first, last, [&out](right_node_t* right_node) {
+      if (right_node == nullptr) {
+        throw std::out_of_range("no entry exists");
+      }
+      *out++ = switch_node(right_node)->value();
+    });
+    return out;
+  }
+
+
   template <typename U = right_t>
   std::enable_if_t<std::is_default_constructible_v<U>, U const&> at_left_or_default(left_t const& left) {
     left_node_t* left_node = left_tree.find(left);
@@ -191,23 +576,81 @@ public:
 
 
   left_iterator lower_bound_left(const left_t& left) const {
+    return lower_bound_left<left_t>(left);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+  left_iterator lower_bound_left(Key const& left) const {
     return left_iterator(left_tree.lower_bound(left));
   }
 
   left_iterator upper_bound_left(const left_t& left) const {
+    return upper_bound_left<left_t>(left);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+  left_iterator upper_bound_left(Key const& left) const {
     return left_iterator(left_tree.upper_bound(left));
   }
 
 
   right_iterator lower_bound_right(const right_t& right) const {
+    return lower_bound_right<right_t>(right);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+  right_iterator lower_bound_right(Key const& right) const {
     return right_iterator(right_tree.lower_bound(right));
   }
 
   right_iterator upper_bound_right(const right_t& right) const {
+    return upper_bound_right<right_t>(right);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+  right_iterator upper_bound_right(Key const& right) const {
     return right_iterator(right_tree.upper_bound(right));
   }
 
 
+  // Subtree sizes kept in the nodes make the positional queries O(log n).
+  left_iterator nth_left(size_t index) const {
+    return left_iterator(left_tree.nth(index));
+  }
+
+  right_iterator nth_right(size_t index) const {
+    return right_iterator(right_tree.nth(index));
+  }
+
+  size_t rank_left(left_t const& left) const {
+    return rank_left<left_t>(left);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+  size_t rank_left(Key const& left) const {
+    return left_tree.rank(left);
+  }
+
+  size_t rank_right(right_t const& right) const {
+    return rank_right<right_t>(right);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+  size_t rank_right(Key const& right) const {
+    return right_tree.rank(right);
+  }
+
+  static ptrdiff_t distance(left_iterator first, left_iterator last) noexcept {
+    return static_cast<ptrdiff_t>(left_tree_t::index_of(last.src_node)) -
+           static_cast<ptrdiff_t>(left_tree_t::index_of(first.src_node));
+  }
+
+  static ptrdiff_t distance(right_iterator first, right_iterator last) noexcept {
+    return static_cast<ptrdiff_t>(right_tree_t::index_of(last.src_node)) -
+           static_cast<ptrdiff_t>(right_tree_t::index_of(first.src_node));
+  }
+
+
   left_iterator begin_left() const {
     return left_iterator(left_tree.get_begin());
   }
@@ -226,6 +669,15 @@ public:
   }
 
 
+  void clear() noexcept {
+    left_tree.clear([this](left_node_t* node) {
+      destroy_node(static_cast<bimap_node_t*>(node));
+    });
+    right_tree.reset();
+    tree_size = 0;
+  }
+
+
   bool empty() const {
     return tree_size == 0;
   }
@@ -234,6 +686,10 @@ public:
     return tree_size;
   }
 
+  Allocator get_allocator() const {
+    return Allocator(allocator);
+  }
+
 
   friend bool operator==(bimap const& a, bimap const& b) {
     return a.compare_equal(b);
@@ -243,13 +699,281 @@ public:
     return !a.compare_equal(b);
   }
 
-  void swap(bimap& other) noexcept {
-    left_tree.swap(other.left_tree);
-    right_tree.swap(other.right_tree);
-    std::swap(tree_size, other.tree_size);
+  // Calls visit(kind, left, right) for every left key whose pair differs
+  // between a and b, in left order, with the right key from b if it was
+  // inserted or remapped and from a if it was removed. Both left trees are
+  // walked once in lockstep. Applying the changes to a gives b if the
+  // removed and remapped pairs are erased before anything is inserted.
+  template <typename Visit>
+  friend void diff(bimap const& a, bimap const& b, Visit&& visit) {
+    join<left_node_t>(a.left_tree, b.left_tree, [&](bimap_node_t* a_node, bimap_node_t* b_node) {
+      if (b_node == nullptr) {
+        visit(change_kind::removed, left_of(a_node), right_of(a_node));
+      } else if (a_node == nullptr) {
+        visit(change_kind::inserted, left_of(b_node), right_of(b_node));
+      } else if (!a.right_tree.compare_equal(right_of(a_node), right_of(b_node))) {
+        visit(change_kind::remapped, left_of(b_node), right_of(b_node));
+      }
+    });
+  }
+
+  // Allocators that do not propagate on swap stay with their bimap, so if
+  // they differ both sides are copied into the other's allocator first.
+  void swap(bimap& other) noexcept(node_traits::propagate_on_container_swap::value ||
+                                   node_traits::is_always_equal::value) {
+    if constexpr (node_traits::propagate_on_container_swap::value) {
+      swap_all(other);
+    } else {
+      if (allocator != other.allocator) {
+        bimap mine(other, allocator);
+        bimap theirs(*this, other.allocator);
+        swap_nodes(mine);
+        other.swap_nodes(theirs);
+        return;
+      }
+      swap_nodes(other);
+    }
+  }
+
+
+  // Read-only search structure over both sides. It copies the keys into
+  // cache friendly arrays but returns iterators into the bimap it was made
+  // from, so it is valid only until that bimap is modified.
+  struct frozen {
+    explicit frozen(bimap const& owner)
+        : left_index(owner.left_tree, owner.size()),
+          right_index(owner.right_tree, owner.size()) {}
+
+    left_iterator find_left(left_t const& left) const {
+      return find_left<left_t>(left);
+    }
+
+    template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+    left_iterator find_left(Key const& left) const {
+      return left_iterator(left_index.find(left));
+    }
+
+    right_iterator find_right(right_t const& right) const {
+      return find_right<right_t>(right);
+    }
+
+    template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+    right_iterator find_right(Key const& right) const {
+      return right_iterator(right_index.find(right));
+    }
+
+
+    left_iterator lower_bound_left(left_t const& left) const {
+      return lower_bound_left<left_t>(left);
+    }
+
+    template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+    left_iterator lower_bound_left(Key const& left) const {
+      return left_iterator(left_index.lower_bound(left));
+    }
+
+    left_iterator upper_bound_left(left_t const& left) const {
+      return upper_bound_left<left_t>(left);
+    }
+
+    template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+    left_iterator upper_bound_left(Key const& left) const {
+      return left_iterator(left_index.upper_bound(left));
+    }
+
+
+    right_iterator lower_bound_right(right_t const& right) const {
+      return lower_bound_right<right_t>(right);
+    }
+
+    template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+    right_iterator lower_bound_right(Key const& right) const {
+      return right_iterator(right_index.lower_bound(right));
+    }
+
+    right_iterator upper_bound_right(right_t const& right) const {
+      return upper_bound_right<right_t>(right);
+    }
+
+    template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+    right_iterator upper_bound_right(Key const& right) const {
+      return right_iterator(right_index.upper_bound(right));
+    }
+
+  private:
+    bimap_impl::frozen_index_t<Left, CompareLeft, bimap_impl::left_tag> left_index;
+    bimap_impl::frozen_index_t<Right, CompareRight, bimap_impl::right_tag> right_index;
+  };
+
+  frozen freeze() const {
+    return frozen(*this);
+  }
+
+
+  // Owns a pair extracted from a bimap until it is inserted into a bimap
+  // with an equal allocator, and frees it if that never happens. The keys
+  // can be changed meanwhile.
+  struct node_type {
+    node_type() = default;
+
+    node_type(node_type&& other) noexcept
+        : node(std::exchange(other.node, nullptr)),
+          allocator(std::move(other.allocator)) {}
+
+    node_type& operator=(node_type&& other) noexcept {
+      if (this != &other) {
+        reset();
+        node = std::exchange(other.node, nullptr);
+        allocator = std::move(other.allocator);
+      }
+      return *this;
+    }
+
+    ~node_type() {
+      reset();
+    }
+
+    bool empty() const noexcept {
+      return node == nullptr;
+    }
+
+    explicit operator bool() const noexcept {
+      return node != nullptr;
+    }
+
+    left_t& left() const noexcept {
+      return static_cast<left_node_t*>(node)->mutable_value();
+    }
+
+    right_t& right() const noexcept {
+      return static_cast<right_node_t*>(node)->mutable_value();
+    }
+
+    Allocator get_allocator() const {
+      return Allocator(*allocator);
+    }
+
+
+    template <typename Left_, typename Right_,
+              typename CompareLeft_, typename CompareRight_, typename Allocator_>
+    friend struct bimap;
+
+  private:
+    node_type(bimap_node_t* node, node_allocator_t const& allocator)
+        : node(node), allocator(allocator) {}
+
+    void reset() noexcept {
+      if (node != nullptr) {
+        node_traits::destroy(*allocator, node);
+        node_traits::deallocate(*allocator, node, 1);
+        node = nullptr;
+      }
+    }
+
+    bimap_node_t* node{nullptr};
+    std::optional<node_allocator_t> allocator;
+  };
+
+
+  // Writes the pairs in the layout of bimap-file.h, which load reads back and
+  // mapped_bimap searches in place. Keys are written byte by byte, so both
+  // sides have to be trivially copyable and must not point anywhere. Errors
+  // are reported by the state of out.
+  template <typename L = left_t, typename R = right_t>
+  std::enable_if_t<bimap_impl::is_file_key_v<L> && bimap_impl::is_file_key_v<R>> save(std::ostream& out) const {
+    bimap_impl::file_header header = bimap_impl::make_file_header<Left, Right>(size());
+    std::vector<position_t> left_positions = positions_by_address<left_node_t>(begin_left(), end_left());
+    std::vector<position_t> right_positions = positions_by_address<right_node_t>(begin_right(), end_right());
+    std::vector<uint64_t> left_flips(size()), right_flips(size());
+    for (size_t i = 0; i < size(); ++i) {
+      left_flips[left_positions[i].second] = right_positions[i].second;
+      right_flips[right_positions[i].second] = left_positions[i].second;
+    }
+    left_positions = std::vector<position_t>();
+    right_positions = std::vector<position_t>();
+
+    out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    bimap_impl::write_padding(out, header.left_offset - sizeof(header));
+    write_records(out, begin_left(), end_left(), left_flips);
+    bimap_impl::write_padding(out, header.right_offset - header.left_offset - size() * sizeof(left_record_t));
+    write_records(out, begin_right(), end_right(), right_flips);
+  }
+
+  // Reads what save wrote in O(n): both trees are built from the sorted
+  // sections instead of inserting the pairs. The order of the keys and the
+  // positions linking them are checked on the way, anything that does not
+  // form a valid bimap under the given comparators throws std::runtime_error.
+  template <typename L = left_t, typename R = right_t>
+  static std::enable_if_t<bimap_impl::is_file_key_v<L> && bimap_impl::is_file_key_v<R>, bimap>
+  load(std::istream& in,
+       CompareLeft compare_left = CompareLeft(),
+       CompareRight compare_right = CompareRight(),
+       Allocator const& allocator = Allocator()) {
+    bimap result(compare_left, compare_right, allocator);
+    bimap_impl::file_header header;
+    bimap_impl::read_exactly(in, &header, sizeof(header));
+    bimap_impl::check_file_header<Left, Right>(header);
+    bimap_impl::skip_exactly(in, header.left_offset - sizeof(header));
+
+    size_t count = header.count;
+    std::vector<left_t> lefts;
+    std::vector<uint64_t> left_flips;
+    std::vector<left_record_t> left_records(std::min<size_t>(count, file_chunk));
+    for (size_t done = 0; done < count;) {
+      size_t chunk = std::min<size_t>(count - done, file_chunk);
+      bimap_impl::read_exactly(in, left_records.data(), chunk * sizeof(left_record_t));
+      for (size_t i = 0; i < chunk; ++i, ++done) {
+        if (left_records[i].position >= count || (done != 0 && !compare_left(lefts.back(), left_records[i].key))) {
+          throw std::runtime_error("corrupt bimap file");
+        }
+        lefts.push_back(left_records[i].key);
+        left_flips.push_back(left_records[i].position);
+      }
+    }
+    left_records = std::vector<left_record_t>();
+    bimap_impl::skip_exactly(in, header.right_offset - header.left_offset - count * sizeof(left_record_t));
+
+    // A right key is accepted only if its left key points back to it, so the
+    // positions of both sections form a one-to-one mapping.
+    std::vector<node_base_t*> left_order(count), right_order(count);
+    std::vector<right_record_t> right_records(std::min<size_t>(count, file_chunk));
+    size_t created = 0;
+    try {
+      while (created < count) {
+        size_t chunk = std::min<size_t>(count - created, file_chunk);
+        bimap_impl::read_exactly(in, right_records.data(), chunk * sizeof(right_record_t));
+        for (size_t i = 0; i < chunk; ++i) {
+          right_record_t const& record = right_records[i];
+          if (record.position >= count || left_flips[record.position] != created ||
+              (created != 0 && !compare_right(*right_iterator(right_order[created - 1]), record.key))) {
+            throw std::runtime_error("corrupt bimap file");
+          }
+          bimap_node_t* node = result.create_node(lefts[record.position], record.key);
+          left_order[record.position] = static_cast<left_node_t*>(node);
+          right_order[created++] = static_cast<right_node_t*>(node);
+        }
+      }
+    } catch (...) {
+      for (size_t i = 0; i < created; ++i) {
+        result.destroy_node(static_cast<bimap_node_t*>(static_cast<right_node_t*>(right_order[i])));
+      }
+      throw;
+    }
+
+    result.left_tree.assign(left_order.data(), left_order.data() + count);
+    result.right_tree.assign(right_order.data(), right_order.data() + count);
+    result.tree_size = count;
+    return result;
   }
 
 private:
+  using position_t = std::pair<bimap_node_t const*, size_t>;
+  using left_record_t = bimap_impl::file_record<Left>;
+  using right_record_t = bimap_impl::file_record<Right>;
+
+  static constexpr size_t file_chunk = 4096;
+  static constexpr size_t stream_chunk = 4096;
+
   static left_node_t* switch_node(right_node_t* node) noexcept {
     return static_cast<left_node_t*>(static_cast<bimap_node_t*>(node));
   }
@@ -272,27 +996,639 @@ private:
     return true;
   }
 
+  // Swaps everything but the allocators.
+  void swap_nodes(bimap& other) noexcept {
+    left_tree.swap(other.left_tree);
+    right_tree.swap(other.right_tree);
+    std::swap(tree_size, other.tree_size);
+  }
+
+  void swap_all(bimap& other) noexcept {
+    swap_nodes(other);
+    std::swap(allocator, other.allocator);
+  }
+
+  // Both trees are rebuilt from sorted sequences instead of inserting pair by pair,
+  // so no comparator is called. A copy is matched to its position on the right side
+  // through a hash table keyed by the address of the original node, which is seen
+  // in both traversals of other, so the whole copy takes expected O(n).
+  void copy_from(bimap const& other) {
+    size_t count = other.size();
+    std::unordered_map<bimap_node_t const*, bimap_node_t*> copies;
+    std::vector<node_base_t*> order(count);
+    copies.reserve(count);
+    size_t index = 0;
+    try {
+      for (left_iterator iter = other.begin_left(); iter != other.end_left(); ++iter, ++index) {
+        bimap_node_t* copy = create_node(*iter, *iter.flip());
+        order[index] = static_cast<node_base_t*>(static_cast<left_node_t*>(copy));
+        try {
+          copies.emplace(static_cast<bimap_node_t const*>(static_cast<left_node_t const*>(iter.src_node)), copy);
+        } catch (...) {
+          destroy_node(copy);
+          throw;
+        }
+      }
+    } catch (...) {
+      for (auto& copy : copies) {
+        destroy_node(copy.second);
+      }
+      throw;
+    }
+    left_tree.assign(order.data(), order.data() + count);
+
+    index = 0;
+    for (right_iterator iter = other.begin_right(); iter != other.end_right(); ++iter, ++index) {
+      bimap_node_t* copy = copies.find(static_cast<bimap_node_t const*>(static_cast<right_node_t const*>(iter.src_node)))->second;
+      order[index] = static_cast<node_base_t*>(static_cast<right_node_t*>(copy));
+    }
+    right_tree.assign(order.data(), order.data() + count);
+    tree_size = count;
+  }
+
+  // Positions of the nodes of [first, last), sorted by their address.
+  template <typename Node, typename Iterator>
+  static std::vector<position_t> positions_by_address(Iterator first, Iterator last) {
+    std::vector<position_t> positions;
+    for (; first != last; ++first) {
+      positions.emplace_back(static_cast<bimap_node_t const*>(static_cast<Node const*>(first.src_node)),
+                             positions.size());
+    }
+    std::less<bimap_node_t const*> address_less;
+    std::sort(positions.begin(), positions.end(), [&](position_t const& a, position_t const& b) {
+      return address_less(a.first, b.first);
+    });
+    return positions;
+  }
+
+  // The records are value-initialized once and only their fields are
+  // assigned, so the padding written out is always zero.
+  template <typename Iterator>
+  static void write_records(std::ostream& out, Iterator first, Iterator last, std::vector<uint64_t> const& flips) {
+    using record_t = bimap_impl::file_record<std::remove_cv_t<std::remove_reference_t<decltype(*first)>>>;
+    std::vector<record_t> records(file_chunk);
+    size_t filled = 0;
+    for (size_t index = 0; first != last; ++first, ++index) {
+      records[filled].key = *first;
+      records[filled].position = flips[index];
+      if (++filled == file_chunk) {
+        out.write(reinterpret_cast<char const*>(records.data()), filled * sizeof(record_t));
+        filled = 0;
+      }
+    }
+    out.write(reinterpret_cast<char const*>(records.data()), filled * sizeof(record_t));
+  }
+
+  template <typename... Args>
+  bimap_node_t* create_node(Args&&... args) {
+    bimap_node_t* node = node_traits::allocate(allocator, 1);
+    try {
+      node_traits::construct(allocator, node, std::forward<Args>(args)...);
+    } catch (...) {
+      node_traits::deallocate(allocator, node, 1);
+      throw;
+    }
+    return node;
+  }
+
+  void destroy_node(bimap_node_t* node) noexcept {
+    node_traits::destroy(allocator, node);
+    node_traits::deallocate(allocator, node, 1);
+  }
+
   template <typename ArgLeft, typename ArgRight>
   left_iterator insert_impl(ArgLeft&& left, ArgRight&& right) {
-    if (left_tree.find(left) != nullptr || right_tree.find(right) != nullptr) {
+    return insert_impl(left_iterator(), right_iterator(),
+                       std::forward<ArgLeft>(left), std::forward<ArgRight>(right));
+  }
+
+  template <typename ArgLeft, typename ArgRight>
+  left_iterator insert_impl(left_iterator left_hint, right_iterator right_hint,
+                            ArgLeft&& left, ArgRight&& right) {
+    bimap_impl::insert_position left_position =
+        left_hint.src_node != nullptr ? left_tree.find_position(left_hint.src_node, left)
+                                      : left_tree.find_position(left);
+    if (left_position.found != nullptr) {
+      return end_left();
+    }
+    bimap_impl::insert_position right_position =
+        right_hint.src_node != nullptr ? right_tree.find_position(right_hint.src_node, right)
+                                       : right_tree.find_position(right);
+    if (right_position.found != nullptr) {
+      return end_left();
+    }
+    bimap_node_t* bimap_node = create_node(std::forward<ArgLeft>(left), std::forward<ArgRight>(right));
+    return link_node(bimap_node, left_position, right_position);
+  }
+
+  // Takes the node: it is either linked or destroyed, even by an exception.
+  left_iterator insert_node(bimap_node_t* bimap_node,
+                            node_base_t* left_hint = nullptr, node_base_t* right_hint = nullptr) {
+    bimap_impl::insert_position left_position, right_position;
+    try {
+      left_t const& left = static_cast<left_node_t*>(bimap_node)->value();
+      right_t const& right = static_cast<right_node_t*>(bimap_node)->value();
+      left_position = left_hint != nullptr ? left_tree.find_position(left_hint, left)
+                                           : left_tree.find_position(left);
+      right_position = right_hint != nullptr ? right_tree.find_position(right_hint, right)
+                                             : right_tree.find_position(right);
+    } catch (...) {
+      destroy_node(bimap_node);
+      throw;
+    }
+    if (left_position.found != nullptr || right_position.found != nullptr) {
+      destroy_node(bimap_node);
       return end_left();
     }
-    bimap_node_t* bimap_node = new bimap_node_t(
-        std::forward<ArgLeft>(left), std::forward<ArgRight>(right));
-    right_tree.insert(static_cast<right_node_t*>(bimap_node));
-    left_node_t* left_node = left_tree.insert(static_cast<left_node_t*>(bimap_node));
+    return link_node(bimap_node, left_position, right_position);
+  }
+
+  // Takes all nodes, which are linked one by one or in bulk, whatever is
+  // cheaper. Nothing is changed if an exception is thrown, the nodes are left
+  // to the caller.
+  void insert_nodes(std::vector<bimap_node_t*>& nodes) {
+    if (prefers_one_by_one(nodes.size())) {
+      insert_one_by_one(nodes);
+    } else {
+      insert_bulk(nodes);
+    }
+  }
+
+  // Links the nodes in order with the ends of the trees as hints. If an
+  // exception is thrown, the nodes linked so far are taken out again.
+  void insert_one_by_one(std::vector<bimap_node_t*>& nodes) {
+    std::vector<bool> linked(nodes.size());
+    size_t i = 0;
+    try {
+      for (; i < nodes.size(); ++i) {
+        left_node_t* left_node = nodes[i];
+        right_node_t* right_node = nodes[i];
+        bimap_impl::insert_position left_position =
+            left_tree.find_position(end_left().src_node, left_node->value());
+        if (left_position.found != nullptr) {
+          continue;
+        }
+        bimap_impl::insert_position right_position =
+            right_tree.find_position(end_right().src_node, right_node->value());
+        if (right_position.found != nullptr) {
+          continue;
+        }
+        link_node(nodes[i], left_position, right_position);
+        linked[i] = true;
+      }
+    } catch (...) {
+      while (i-- > 0) {
+        if (linked[i]) {
+          left_tree.unlink(nodes[i]);
+          right_tree.unlink(nodes[i]);
+          --tree_size;
+        }
+      }
+      throw;
+    }
+    for (i = 0; i < nodes.size(); ++i) {
+      if (!linked[i]) {
+        destroy_node(nodes[i]);
+      }
+    }
+    nodes.clear();
+  }
+
+  // Whether count lookups cost less than walking the whole bimap.
+  bool prefers_one_by_one(size_t count) const noexcept {
+    size_t depth = 1;
+    for (size_t n = size(); n > 1; n >>= 1) {
+      ++depth;
+    }
+    return count * depth < size();
+  }
+
+  // Reads nodes with read, which appends one and returns true or returns
+  // false at the end, and inserts them chunk_size at a time.
+  template <typename Read>
+  void insert_chunks(size_t chunk_size, Read read) {
+    chunk_size = std::max<size_t>(chunk_size, 1);
+    std::vector<bimap_node_t*> nodes;
+    nodes.reserve(chunk_size);
+    try {
+      for (bool more = true; more;) {
+        while (nodes.size() < chunk_size && (more = read(nodes))) {
+        }
+        insert_nodes(nodes);
+        nodes.clear();
+      }
+    } catch (...) {
+      destroy_nodes(nodes);
+      throw;
+    }
+  }
+
+  // Takes all nodes: the accepted ones are linked, the rest are destroyed.
+  // Nothing is changed if an exception is thrown, the nodes are left to the caller.
+  void insert_bulk(std::vector<bimap_node_t*>& nodes) {
+    std::vector<size_t> left_order, left_groups, right_order, right_groups;
+    size_t left_count = bimap_impl::sort_by_key(nodes.size(), key_of<left_node_t>(nodes),
+                                                left_tree.get_comparator(), left_order, left_groups);
+    size_t right_count = bimap_impl::sort_by_key(nodes.size(), key_of<right_node_t>(nodes),
+                                                 right_tree.get_comparator(), right_order, right_groups);
+
+    std::vector<bool> left_taken(left_count), right_taken(right_count);
+    if (!empty()) {
+      left_tree.mark_existing(node_of<left_node_t>(nodes), left_order, left_groups, left_taken);
+      right_tree.mark_existing(node_of<right_node_t>(nodes), right_order, right_groups, right_taken);
+    }
+    std::vector<bool> accepted(nodes.size());
+    size_t accepted_count = 0;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      if (!left_taken[left_groups[i]] && !right_taken[right_groups[i]]) {
+        left_taken[left_groups[i]] = true;
+        right_taken[right_groups[i]] = true;
+        accepted[i] = true;
+        ++accepted_count;
+      }
+    }
+
+    std::vector<node_base_t*> left_sorted, right_sorted;
+    left_tree.merge_sorted(node_of<left_node_t>(nodes), left_order, accepted, left_sorted);
+    right_tree.merge_sorted(node_of<right_node_t>(nodes), right_order, accepted, right_sorted);
+
+    left_tree.assign(left_sorted.data(), left_sorted.data() + left_sorted.size());
+    right_tree.assign(right_sorted.data(), right_sorted.data() + right_sorted.size());
+    tree_size += accepted_count;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      if (!accepted[i]) {
+        destroy_node(nodes[i]);
+      }
+    }
+    nodes.clear();
+  }
+
+  template <typename Node>
+  static auto node_of(std::vector<bimap_node_t*> const& nodes) noexcept {
+    return [&nodes](size_t index) {
+      return static_cast<Node*>(nodes[index]);
+    };
+  }
+
+  template <typename Node>
+  static auto key_of(std::vector<bimap_node_t*> const& nodes) noexcept {
+    return [&nodes](size_t index) -> decltype(auto) {
+      return static_cast<Node*>(nodes[index])->value();
+    };
+  }
+
+  void destroy_nodes(std::vector<bimap_node_t*> const& nodes) noexcept {
+    for (bimap_node_t* bimap_node : nodes) {
+      if (bimap_node != nullptr) {
+        destroy_node(bimap_node);
+      }
+    }
+  }
+
+  left_iterator link_node(bimap_node_t* bimap_node,
+                          bimap_impl::insert_position const& left_position,
+                          bimap_impl::insert_position const& right_position) noexcept {
+    right_tree.insert(right_position, static_cast<right_node_t*>(bimap_node));
+    left_node_t* left_node = left_tree.insert(left_position, static_cast<left_node_t*>(bimap_node));
     ++tree_size;
     return left_iterator(static_cast<node_base_t*>(left_node));
   }
 
   std::pair<left_iterator, right_iterator> remove(bimap_node_t* bimap_node) {
+    std::pair<left_iterator, right_iterator> next = unlink(bimap_node);
+    destroy_node(bimap_node);
+    return next;
+  }
+
+  // Takes the node out of both trees without freeing it.
+  std::pair<left_iterator, right_iterator> unlink(bimap_node_t* bimap_node) {
     node_base_t* left_node = left_tree.remove(static_cast<left_node_t*>(bimap_node));
     node_base_t* right_node = right_tree.remove(static_cast<right_node_t*>(bimap_node));
     --tree_size;
-    delete bimap_node;
     return {left_iterator(left_node), right_iterator(right_node)};
   }
 
+  // The node leaves the tree before its key is assigned, so the tree never
+  // sees it out of order. If that throws, the node is taken out of the other
+  // tree too and freed.
+  template <typename Node, typename Tree, typename Arg>
+  node_base_t* replace_key(Tree& tree, node_base_t* point, Arg&& key) {
+    Node* node = static_cast<Node*>(point);
+    node_base_t* found = tree.find_position(key).found;
+    if (found != nullptr && found != point) {
+      return tree.get_end();
+    }
+    tree.remove(node);
+    try {
+      node->mutable_value() = std::forward<Arg>(key);
+      tree.insert(tree.find_position(node->value()), node);
+    } catch (...) {
+      if constexpr (std::is_same_v<Node, left_node_t>) {
+        right_tree.remove(switch_node(node));
+      } else {
+        left_tree.remove(switch_node(node));
+      }
+      --tree_size;
+      destroy_node(static_cast<bimap_node_t*>(node));
+      throw;
+    }
+    return point;
+  }
+
+  static left_t const& left_of(bimap_node_t* bimap_node) noexcept {
+    return static_cast<left_node_t*>(bimap_node)->value();
+  }
+
+  static right_t const& right_of(bimap_node_t* bimap_node) noexcept {
+    return static_cast<right_node_t*>(bimap_node)->value();
+  }
+
+  template <typename OutputIt>
+  static auto reporter(OutputIt& conflicts) {
+    return [&conflicts](bimap_node_t* bimap_node) {
+      *conflicts = std::pair<left_t, right_t>(left_of(bimap_node), right_of(bimap_node));
+      ++conflicts;
+    };
+  }
+
+  // Calls visit(a, b) for the nodes of both trees in key order, with the
+  // nodes of equal keys together and nullptr for a key only one tree has.
+  template <typename Node, typename Tree, typename Visit>
+  static void join(Tree const& a, Tree const& b, Visit&& visit) {
+    auto const& compare = a.get_comparator();
+    node_base_t* a_point = a.get_begin();
+    node_base_t* b_point = b.get_begin();
+    while (a_point != a.get_end() || b_point != b.get_end()) {
+      Node* a_node = a_point != a.get_end() ? static_cast<Node*>(a_point) : nullptr;
+      Node* b_node = b_point != b.get_end() ? static_cast<Node*>(b_point) : nullptr;
+      if (a_node != nullptr && b_node != nullptr) {
+        if (compare(a_node->value(), b_node->value())) {
+          b_node = nullptr;
+        } else if (compare(b_node->value(), a_node->value())) {
+          a_node = nullptr;
+        }
+      }
+      visit(a_node != nullptr ? static_cast<bimap_node_t*>(a_node) : nullptr,
+            b_node != nullptr ? static_cast<bimap_node_t*>(b_node) : nullptr);
+      if (a_node != nullptr) {
+        a_point = Tree::next(a_point);
+      }
+      if (b_node != nullptr) {
+        b_point = Tree::next(b_point);
+      }
+    }
+  }
+
+  // Links the nodes take makes of the given nodes of other, in left order,
+  // one by one where both keys are free, each first tried right after the
+  // previous one in the left tree.
+  template <typename Take, typename Report>
+  void add_each(std::vector<bimap_node_t*> const& nodes, Take&& take, Report& report) {
+    node_base_t* left_hint = nullptr;
+    for (bimap_node_t* bimap_node : nodes) {
+      bimap_impl::insert_position left_position =
+          left_hint != nullptr ? left_tree.find_position(left_hint, left_of(bimap_node))
+                               : left_tree.find_position(left_of(bimap_node));
+      if (left_position.found != nullptr) {
+        bimap_node_t* found = static_cast<bimap_node_t*>(static_cast<left_node_t*>(left_position.found));
+        if (!right_tree.compare_equal(right_of(found), right_of(bimap_node))) {
+          report(bimap_node);
+        }
+        continue;
+      }
+      bimap_impl::insert_position right_position = right_tree.find_position(right_of(bimap_node));
+      if (right_position.found != nullptr) {
+        report(bimap_node);
+        continue;
+      }
+      left_hint = link_node(take(bimap_node), left_position, right_position).src_node;
+    }
+  }
+
+  // Adds the pairs of other whose keys are both free here, as the nodes
+  // take_one makes of them if they are linked one by one, which they are if
+  // there are only a few of them after the left walk, or as those take_all
+  // makes of them if both trees are rebuilt. Right before that, rebuild is
+  // called with the map from the nodes of other with a free left key to
+  // what take_all made of them, or to nullptr.
+  template <typename TakeOne, typename TakeAll, typename Report, typename Rebuild>
+  void add_impl(bimap const& other, TakeOne&& take_one, TakeAll&& take_all, Report& report, Rebuild&& rebuild) {
+    std::vector<bimap_node_t*> left_free;
+    if (prefers_one_by_one(other.size())) {
+      for (node_base_t* point = other.left_tree.get_begin(); point != other.left_tree.get_end();
+           point = left_tree_t::next(point)) {
+        left_free.push_back(static_cast<bimap_node_t*>(static_cast<left_node_t*>(point)));
+      }
+      add_each(left_free, take_one, report);
+      return;
+    }
+    std::vector<node_base_t*> left_sorted;
+    join<left_node_t>(left_tree, other.left_tree, [&](bimap_node_t* a, bimap_node_t* b) {
+      if (a == nullptr) {
+        left_sorted.push_back(nullptr);
+        left_free.push_back(b);
+        return;
+      }
+      left_sorted.push_back(static_cast<left_node_t*>(a));
+      if (b != nullptr && !right_tree.compare_equal(right_of(a), right_of(b))) {
+        report(b);
+      }
+    });
+    if (prefers_one_by_one(left_free.size())) {
+      add_each(left_free, take_one, report);
+      return;
+    }
+
+    std::unordered_map<bimap_node_t const*, bimap_node_t*> taken;
+    taken.reserve(left_free.size());
+    for (bimap_node_t* bimap_node : left_free) {
+      taken.emplace(bimap_node, nullptr);
+    }
+    std::vector<node_base_t*> right_sorted;
+    size_t count = 0;
+    try {
+      join<right_node_t>(right_tree, other.right_tree, [&](bimap_node_t* a, bimap_node_t* b) {
+        if (a != nullptr) {
+          right_sorted.push_back(static_cast<right_node_t*>(a));
+        }
+        auto it = b != nullptr ? taken.find(b) : taken.end();
+        if (it == taken.end()) {
+          return;
+        }
+        if (a != nullptr) {
+          report(b);
+          return;
+        }
+        it->second = take_all(b);
+        right_sorted.push_back(static_cast<right_node_t*>(it->second));
+        ++count;
+      });
+    } catch (...) {
+      for (auto const& entry : taken) {
+        if (entry.second != nullptr && entry.second != entry.first) {
+          destroy_node(entry.second);
+        }
+      }
+      throw;
+    }
+
+    size_t filled = 0;
+    auto free_it = left_free.begin();
+    for (size_t i = 0; i < left_sorted.size(); ++i) {
+      node_base_t* point = left_sorted[i];
+      if (point == nullptr) {
+        bimap_node_t* bimap_node = taken[*free_it++];
+        if (bimap_node == nullptr) {
+          continue;
+        }
+        point = static_cast<left_node_t*>(bimap_node);
+      }
+      left_sorted[filled++] = point;
+    }
+    left_sorted.resize(filled);
+    rebuild(taken);
+    left_tree.assign(left_sorted.data(), left_sorted.data() + left_sorted.size());
+    right_tree.assign(right_sorted.data(), right_sorted.data() + right_sorted.size());
+    tree_size += count;
+  }
+
+  // Nodes of the tree in order, without those taken.
+  template <typename Node, typename Tree>
+  static std::vector<node_base_t*> remaining(Tree const& tree,
+                                             std::unordered_map<bimap_node_t const*, bimap_node_t*> const& taken) {
+    std::vector<node_base_t*> sorted;
+    for (node_base_t* point = tree.get_begin(); point != tree.get_end(); point = Tree::next(point)) {
+      auto it = taken.find(static_cast<bimap_node_t*>(static_cast<Node*>(point)));
+      if (it == taken.end() || it->second == nullptr) {
+        sorted.push_back(point);
+      }
+    }
+    return sorted;
+  }
+
+  template <typename Report>
+  void merge_impl(bimap& other, Report&& report) {
+    if (&other == this) {
+      return;
+    }
+    assert(other.allocator == allocator);
+    auto unlink_one = [&other](bimap_node_t* bimap_node) {
+      other.unlink(bimap_node);
+      return bimap_node;
+    };
+    auto keep = [](bimap_node_t* bimap_node) {
+      return bimap_node;
+    };
+    add_impl(other, unlink_one, keep, report, [&other](auto const& taken) {
+      std::vector<node_base_t*> other_left = remaining<left_node_t>(other.left_tree, taken);
+      std::vector<node_base_t*> other_right = remaining<right_node_t>(other.right_tree, taken);
+      other.left_tree.assign(other_left.data(), other_left.data() + other_left.size());
+      other.right_tree.assign(other_right.data(), other_right.data() + other_right.size());
+      other.tree_size = other_left.size();
+    });
+  }
+
+  template <typename Report>
+  void unite_impl(bimap const& other, Report&& report) {
+    if (&other == this) {
+      return;
+    }
+    auto copy = [this](bimap_node_t* bimap_node) {
+      return create_node(left_of(bimap_node), right_of(bimap_node));
+    };
+    add_impl(other, copy, copy, report, [](auto const&) {});
+  }
+
+  // Sorts the pairs here into kept and dropped ones by the left walk, in
+  // which other's pairs with a free left key are collected too, since they
+  // can still conflict on the right side. When that leaves little to do,
+  // it is done with lookups, otherwise the right sides are walked as well
+  // and both trees are rebuilt. A pair here is matched by a pair of other
+  // in the right walk exactly if they are equal.
+  template <typename Report>
+  void filter_impl(bimap const& other, bool keep_equal, Report& report) {
+    std::vector<node_base_t*> left_sorted;
+    std::vector<bimap_node_t*> dropped, left_free;
+    join<left_node_t>(left_tree, other.left_tree, [&](bimap_node_t* a, bimap_node_t* b) {
+      if (a == nullptr) {
+        left_free.push_back(b);
+        return;
+      }
+      bool equal = b != nullptr && right_tree.compare_equal(right_of(a), right_of(b));
+      if (equal == keep_equal) {
+        left_sorted.push_back(static_cast<left_node_t*>(a));
+      } else {
+        dropped.push_back(a);
+      }
+      if (b != nullptr && !equal) {
+        report(b);
+      }
+    });
+    if (prefers_one_by_one(left_free.size() + dropped.size())) {
+      for (bimap_node_t* bimap_node : left_free) {
+        if (right_tree.find(right_of(bimap_node)) != nullptr) {
+          report(bimap_node);
+        }
+      }
+      for (bimap_node_t* bimap_node : dropped) {
+        remove(bimap_node);
+      }
+      return;
+    }
+
+    std::unordered_set<bimap_node_t const*> free_set(left_free.begin(), left_free.end());
+    std::vector<node_base_t*> right_sorted;
+    join<right_node_t>(right_tree, other.right_tree, [&](bimap_node_t* a, bimap_node_t* b) {
+      if (a == nullptr) {
+        return;
+      }
+      bool equal = b != nullptr && left_tree.compare_equal(left_of(a), left_of(b));
+      if (equal == keep_equal) {
+        right_sorted.push_back(static_cast<right_node_t*>(a));
+      }
+      if (b != nullptr && !equal && free_set.count(b) != 0) {
+        report(b);
+      }
+    });
+    left_tree.assign(left_sorted.data(), left_sorted.data() + left_sorted.size());
+    right_tree.assign(right_sorted.data(), right_sorted.data() + right_sorted.size());
+    tree_size = left_sorted.size();
+    destroy_nodes(dropped);
+  }
+
+  template <typename Report>
+  void intersect_impl(bimap const& other, Report&& report) {
+    if (&other != this) {
+      filter_impl(other, true, report);
+    }
+  }
+
+  template <typename Report>
+  void subtract_impl(bimap const& other, Report&& report) {
+    if (&other == this) {
+      clear();
+      return;
+    }
+    if (!prefers_one_by_one(other.size())) {
+      filter_impl(other, false, report);
+      return;
+    }
+    for (node_base_t* point = other.left_tree.get_begin(); point != other.left_tree.get_end();
+         point = left_tree_t::next(point)) {
+      bimap_node_t* bimap_node = static_cast<bimap_node_t*>(static_cast<left_node_t*>(point));
+      left_node_t* found = left_tree.find(left_of(bimap_node));
+      if (found == nullptr) {
+        if (right_tree.find(right_of(bimap_node)) != nullptr) {
+          report(bimap_node);
+        }
+      } else if (right_tree.compare_equal(right_of(static_cast<bimap_node_t*>(found)), right_of(bimap_node))) {
+        remove(static_cast<bimap_node_t*>(found));
+      } else {
+        report(bimap_node);
+      }
+    }
+  }
+
   template <typename Value, typename Compare, typename Tag,
             typename FlipValue, typename FlipCompare, typename FlipTag>
   struct base_iterator {
@@ -358,7 +1694,7 @@ private:
 
 
     template <typename Left_, typename Right_,
-              typename CompareLeft_, typename CompareRight_>
+              typename CompareLeft_, typename CompareRight_, typename Allocator_>
     friend struct bimap;
 
   private:
@@ -369,5 +1705,6 @@ private:
 
   left_tree_t left_tree;
   right_tree_t right_tree;
+  [[no_unique_address]] node_allocator_t allocator;
   size_t tree_size{0};
 };
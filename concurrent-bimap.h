@@ -0,0 +1,218 @@
+#pragma once
+
+#include "bimap.h"
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+
+namespace bimap_impl {
+  // Number of readers inside one version of a concurrent_bimap. Threads are
+  // spread over several counters on their own cache lines, so readers on
+  // different cores rarely write to the same line.
+  struct read_indicator {
+    void arrive() noexcept;
+
+    void depart() noexcept;
+
+    bool is_empty() const noexcept;
+
+  private:
+    static constexpr size_t slot_count = 16;
+
+    struct alignas(64) slot {
+      std::atomic<size_t> readers{0};
+    };
+
+    static size_t this_slot() noexcept;
+
+    slot slots[slot_count];
+  };
+}
+
+// bimap shared between threads with the left-right technique: it keeps two
+// copies of the bimap, readers use the one that is published and writers,
+// one at a time, change the other one, publish it, wait for the readers of
+// the old one to leave and repeat the change there. Reads take a bounded
+// number of steps whatever the writers do and always see both sides of the
+// same set of pairs. The price is twice the memory and every write done twice.
+template <typename Left, typename Right,
+          typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>,
+          typename Allocator = std::allocator<std::pair<Left, Right>>>
+struct concurrent_bimap {
+private:
+  using left_t = Left;
+  using right_t = Right;
+  using bimap_t = bimap<Left, Right, CompareLeft, CompareRight, Allocator>;
+
+public:
+  concurrent_bimap(CompareLeft compare_left = CompareLeft(),
+                   CompareRight compare_right = CompareRight(),
+                   Allocator const& allocator = Allocator())
+      : instances{bimap_t(compare_left, compare_right, allocator),
+                  bimap_t(compare_left, compare_right, allocator)} {}
+
+  concurrent_bimap(concurrent_bimap const&) = delete;
+  concurrent_bimap& operator=(concurrent_bimap const&) = delete;
+
+
+  // Runs f on the published bimap and returns its result. f must not modify
+  // the bimap, and nothing it returns may refer into it.
+  template <typename F>
+  auto read(F&& f) const {
+    size_t version = version_index.load();
+    indicators[version].arrive();
+    struct departure {
+      bimap_impl::read_indicator& indicator;
+
+      ~departure() {
+        indicator.depart();
+      }
+    } guard{indicators[version]};
+    return f(static_cast<bimap_t const&>(instances[left_right.load()]));
+  }
+
+
+  std::optional<right_t> find_left(left_t const& left) const {
+    return find_left<left_t>(left);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+  std::optional<right_t> find_left(Key const& left) const {
+    return read([&left](bimap_t const& b) -> std::optional<right_t> {
+      auto it = b.find_left(left);
+      if (it == b.end_left()) {
+        return std::nullopt;
+      }
+      return *it.flip();
+    });
+  }
+
+  std::optional<left_t> find_right(right_t const& right) const {
+    return find_right<right_t>(right);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+  std::optional<left_t> find_right(Key const& right) const {
+    return read([&right](bimap_t const& b) -> std::optional<left_t> {
+      auto it = b.find_right(right);
+      if (it == b.end_right()) {
+        return std::nullopt;
+      }
+      return *it.flip();
+    });
+  }
+
+
+  right_t at_left(left_t const& key) const {
+    return at_left<left_t>(key);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+  right_t at_left(Key const& key) const {
+    return read([&key](bimap_t const& b) -> right_t { return b.at_left(key); });
+  }
+
+  left_t at_right(right_t const& key) const {
+    return at_right<right_t>(key);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+  left_t at_right(Key const& key) const {
+    return read([&key](bimap_t const& b) -> left_t { return b.at_right(key); });
+  }
+
+
+  bool empty() const {
+    return read([](bimap_t const& b) { return b.empty(); });
+  }
+
+  size_t size() const {
+    return read([](bimap_t const& b) { return b.size(); });
+  }
+
+
+  bool insert(left_t const& left, right_t const& right) {
+    return write([&](bimap_t& b) { return b.insert(left, right) != b.end_left(); });
+  }
+
+  bool erase_left(left_t const& left) {
+    return write([&](bimap_t& b) { return b.erase_left(left); });
+  }
+
+  bool erase_right(right_t const& right) {
+    return write([&](bimap_t& b) { return b.erase_right(right); });
+  }
+
+  void clear() {
+    write([](bimap_t& b) { b.clear(); });
+  }
+
+  // Applies f to both copies in turn and returns what the first call
+  // returned. f has to change both of them the same way and must not move
+  // from its captures. If the first call throws, the hidden copy is restored
+  // from the published one and the exception is rethrown, so the write has
+  // no effect. If the second call throws, the change is already visible to
+  // readers: the second copy is restored from the first one, the exception
+  // is swallowed and the write counts as done.
+  template <typename F>
+  auto write(F&& f) {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    size_t published = left_right.load();
+    if constexpr (std::is_void_v<std::invoke_result_t<F&, bimap_t&>>) {
+      apply_hidden(f, published);
+      publish(f, published);
+    } else {
+      auto result = apply_hidden(f, published);
+      publish(f, published);
+      return result;
+    }
+  }
+
+private:
+  template <typename F>
+  decltype(auto) apply_hidden(F& f, size_t published) {
+    try {
+      return f(instances[1 - published]);
+    } catch (...) {
+      instances[1 - published] = instances[published];
+      throw;
+    }
+  }
+
+  template <typename F>
+  void publish(F& f, size_t published) {
+    left_right.store(1 - published);
+    toggle_version();
+    try {
+      f(instances[published]);
+    } catch (...) {
+      instances[published] = instances[1 - published];
+    }
+  }
+
+  // Once this returns, no reader can still be using the copy that was
+  // published before the last store to left_right.
+  void toggle_version() {
+    size_t previous = version_index.load();
+    size_t next = 1 - previous;
+    wait_for_readers(indicators[next]);
+    version_index.store(next);
+    wait_for_readers(indicators[previous]);
+  }
+
+  static void wait_for_readers(bimap_impl::read_indicator const& indicator) {
+    while (!indicator.is_empty()) {
+      std::this_thread::yield();
+    }
+  }
+
+  bimap_t instances[2];
+  std::atomic<size_t> left_right{0};
+  std::atomic<size_t> version_index{0};
+  mutable bimap_impl::read_indicator indicators[2];
+  std::mutex writer_mutex;
+};
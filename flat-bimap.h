@@ -0,0 +1,543 @@
+#pragma once
+
+#include "sorted-array.h"
+#include "tree.h"
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <numeric>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// bimap over two sorted arrays, one per side, where every entry also stores
+// the position of its pair on the other side. Lookups are binary searches
+// over contiguous keys; inserting or erasing a single pair is O(n), so
+// batches should go through the range insert and erase, which are O(n)
+// after sorting the batch. Any modification invalidates all iterators.
+template <typename Left, typename Right,
+          typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>>
+struct flat_bimap : bimap_impl::sorted_array_sides<flat_bimap<Left, Right, CompareLeft, CompareRight>> {
+private:
+  using left_t = Left;
+  using right_t = Right;
+  using left_tag = bimap_impl::left_tag;
+  using right_tag = bimap_impl::right_tag;
+  using base_t = bimap_impl::sorted_array_sides<flat_bimap>;
+
+public:
+  using left_iterator = bimap_impl::array_iterator<flat_bimap, Left, left_tag, Right, right_tag>;
+  using right_iterator = bimap_impl::array_iterator<flat_bimap, Right, right_tag, Left, left_tag>;
+
+  flat_bimap(CompareLeft compare_left = CompareLeft(),
+             CompareRight compare_right = CompareRight())
+      : compare_left(std::move(compare_left)),
+        compare_right(std::move(compare_right)) {}
+
+  template <typename InputIt, typename = bimap_impl::enable_if_pair_iterator_t<InputIt>>
+  flat_bimap(InputIt first, InputIt last,
+             CompareLeft compare_left = CompareLeft(),
+             CompareRight compare_right = CompareRight())
+      : flat_bimap(std::move(compare_left), std::move(compare_right)) {
+    insert(first, last);
+  }
+
+
+  left_iterator insert(left_t const& left, right_t const& right) {
+    return insert_impl(left, right);
+  }
+
+  left_iterator insert(left_t const& left, right_t&& right) {
+    return insert_impl(left, std::move(right));
+  }
+
+  left_iterator insert(left_t&& left, right_t const& right) {
+    return insert_impl(std::move(left), right);
+  }
+
+  left_iterator insert(left_t&& left, right_t&& right) {
+    return insert_impl(std::move(left), std::move(right));
+  }
+
+  // Same result as inserting the pairs one by one, but the batch is sorted
+  // and merged into both arrays at once. If anything throws, the bimap is
+  // left unchanged.
+  template <typename InputIt, typename = bimap_impl::enable_if_pair_iterator_t<InputIt>>
+  void insert(InputIt first, InputIt last) {
+    std::vector<left_t> added_lefts;
+    std::vector<right_t> added_rights;
+    for (; first != last; ++first) {
+      auto&& pair = *first;
+      added_lefts.emplace_back(std::get<0>(std::forward<decltype(pair)>(pair)));
+      added_rights.emplace_back(std::get<1>(std::forward<decltype(pair)>(pair)));
+    }
+    merge_batch(added_lefts, added_rights);
+  }
+
+
+  left_iterator erase_left(left_iterator it) {
+    erase_range(left_iterator(this, it.index), left_iterator(this, it.index + 1));
+    return left_iterator(this, it.index);
+  }
+
+  bool erase_left(left_t const& left) {
+    return erase_left<left_t>(left);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft> &&
+                                                      !std::is_convertible_v<Key, left_iterator>>>
+  bool erase_left(Key const& left) {
+    left_iterator it = find_left(left);
+    if (it == end_left()) {
+      return false;
+    }
+    erase_left(it);
+    return true;
+  }
+
+  right_iterator erase_right(right_iterator it) {
+    erase_range(right_iterator(this, it.index), right_iterator(this, it.index + 1));
+    return right_iterator(this, it.index);
+  }
+
+  bool erase_right(right_t const& right) {
+    return erase_right<right_t>(right);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight> &&
+                                                      !std::is_convertible_v<Key, right_iterator>>>
+  bool erase_right(Key const& right) {
+    right_iterator it = find_right(right);
+    if (it == end_right()) {
+      return false;
+    }
+    erase_right(it);
+    return true;
+  }
+
+  left_iterator erase_left(left_iterator first, left_iterator last) {
+    erase_range(first, last);
+    return left_iterator(this, first.index);
+  }
+
+  right_iterator erase_right(right_iterator first, right_iterator last) {
+    erase_range(first, last);
+    return right_iterator(this, first.index);
+  }
+
+
+  left_iterator find_left(left_t const& left) const {
+    return find_left<left_t>(left);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+  left_iterator find_left(Key const& left) const {
+    return left_iterator(this, this->template find_index<left_tag>(left));
+  }
+
+  right_iterator find_right(right_t const& right) const {
+    return find_right<right_t>(right);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+  right_iterator find_right(Key const& right) const {
+    return right_iterator(this, this->template find_index<right_tag>(right));
+  }
+
+
+  right_t const& at_left(left_t const& key) const {
+    return at_left<left_t>(key);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+  right_t const& at_left(Key const& key) const {
+    left_iterator it = find_left(key);
+    if (it == end_left()) {
+      throw std::out_of_range("no entry exists");
+    }
+    return *it.flip();
+  }
+
+  left_t const& at_right(right_t const& key) const {
+    return at_right<right_t>(key);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+  left_t const& at_right(Key const& key) const {
+    right_iterator it = find_right(key);
+    if (it == end_right()) {
+      throw std::out_of_range("no entry exists");
+    }
+    return *it.flip();
+  }
+
+
+  template <typename U = right_t>
+  std::enable_if_t<std::is_default_constructible_v<U>, U const&> at_left_or_default(left_t const& left) {
+    left_iterator it = find_left(left);
+    if (it == end_left()) {
+      right_t right = right_t();
+      erase_right(right);
+      return *insert(left, right).flip();
+    }
+    return *it.flip();
+  }
+
+  template <typename U = left_t>
+  std::enable_if_t<std::is_default_constructible_v<U>, U const&> at_right_or_default(right_t const& right) {
+    right_iterator it = find_right(right);
+    if (it == end_right()) {
+      left_t left = left_t();
+      erase_left(left);
+      return *insert(left, right);
+    }
+    return *it.flip();
+  }
+
+
+  left_iterator lower_bound_left(const left_t& left) const {
+    return lower_bound_left<left_t>(left);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+  left_iterator lower_bound_left(Key const& left) const {
+    return left_iterator(this, this->template lower_index<left_tag>(left));
+  }
+
+  left_iterator upper_bound_left(const left_t& left) const {
+    return upper_bound_left<left_t>(left);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+  left_iterator upper_bound_left(Key const& left) const {
+    return left_iterator(this, this->template upper_index<left_tag>(left));
+  }
+
+
+  right_iterator lower_bound_right(const right_t& right) const {
+    return lower_bound_right<right_t>(right);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+  right_iterator lower_bound_right(Key const& right) const {
+    return right_iterator(this, this->template lower_index<right_tag>(right));
+  }
+
+  right_iterator upper_bound_right(const right_t& right) const {
+    return upper_bound_right<right_t>(right);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+  right_iterator upper_bound_right(Key const& right) const {
+    return right_iterator(this, this->template upper_index<right_tag>(right));
+  }
+
+
+  left_iterator begin_left() const {
+    return left_iterator(this, 0);
+  }
+
+  left_iterator end_left() const {
+    return left_iterator(this, size());
+  }
+
+
+  right_iterator begin_right() const {
+    return right_iterator(this, 0);
+  }
+
+  right_iterator end_right() const {
+    return right_iterator(this, size());
+  }
+
+
+  void clear() noexcept {
+    lefts.clear();
+    left_flips.clear();
+    rights.clear();
+    right_flips.clear();
+  }
+
+  bool empty() const {
+    return lefts.empty();
+  }
+
+  size_t size() const {
+    return lefts.size();
+  }
+
+
+  friend bool operator==(flat_bimap const& a, flat_bimap const& b) {
+    return a.compare_equal(b);
+  }
+
+  friend bool operator!=(flat_bimap const& a, flat_bimap const& b) {
+    return !a.compare_equal(b);
+  }
+
+  void swap(flat_bimap& other) noexcept {
+    lefts.swap(other.lefts);
+    left_flips.swap(other.left_flips);
+    rights.swap(other.rights);
+    right_flips.swap(other.right_flips);
+    std::swap(compare_left, other.compare_left);
+    std::swap(compare_right, other.compare_right);
+  }
+
+private:
+  template <typename Tag>
+  auto const& get_keys() const noexcept {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return lefts;
+    } else {
+      return rights;
+    }
+  }
+
+  template <typename Tag>
+  std::vector<size_t> const& get_flips() const noexcept {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return left_flips;
+    } else {
+      return right_flips;
+    }
+  }
+
+  template <typename Tag>
+  auto const& get_compare() const noexcept {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return compare_left;
+    } else {
+      return compare_right;
+    }
+  }
+
+  template <typename Tag>
+  auto const& key_at(size_t index) const noexcept {
+    return get_keys<Tag>()[index];
+  }
+
+  template <typename Tag>
+  size_t flip_at(size_t index) const noexcept {
+    return get_flips<Tag>()[index];
+  }
+
+  bool compare_equal(flat_bimap const& other) const {
+    if (size() != other.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < size(); ++i) {
+      right_t const& right = rights[left_flips[i]];
+      right_t const& other_right = other.rights[other.left_flips[i]];
+      if (compare_left(lefts[i], other.lefts[i]) || compare_left(other.lefts[i], lefts[i]) ||
+          compare_right(right, other_right) || compare_right(other_right, right)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  template <typename ArgLeft, typename ArgRight>
+  left_iterator insert_impl(ArgLeft&& left, ArgRight&& right) {
+    size_t left_index = this->template lower_index<left_tag>(left);
+    if (left_index != size() && !compare_left(left, lefts[left_index])) {
+      return end_left();
+    }
+    size_t right_index = this->template lower_index<right_tag>(right);
+    if (right_index != size() && !compare_right(right, rights[right_index])) {
+      return end_left();
+    }
+
+    lefts.reserve(size() + 1);
+    rights.reserve(size() + 1);
+    left_flips.reserve(size() + 1);
+    right_flips.reserve(size() + 1);
+    lefts.insert(lefts.begin() + left_index, std::forward<ArgLeft>(left));
+    try {
+      rights.insert(rights.begin() + right_index, std::forward<ArgRight>(right));
+    } catch (...) {
+      lefts.erase(lefts.begin() + left_index);
+      throw;
+    }
+
+    for (size_t& flip : left_flips) {
+      flip += flip >= right_index;
+    }
+    for (size_t& flip : right_flips) {
+      flip += flip >= left_index;
+    }
+    left_flips.insert(left_flips.begin() + left_index, right_index);
+    right_flips.insert(right_flips.begin() + right_index, left_index);
+    return left_iterator(this, left_index);
+  }
+
+  // Removes the pairs in [first, last) of one side and renumbers the
+  // positions left on both sides in a single pass over each array.
+  template <typename Iterator>
+  void erase_range(Iterator first, Iterator last) {
+    if (first == last) {
+      return;
+    }
+    std::vector<bool> removed_left(size());
+    for (Iterator it = first; it != last; ++it) {
+      if constexpr (std::is_same_v<Iterator, left_iterator>) {
+        removed_left[it.index] = true;
+      } else {
+        removed_left[right_flips[it.index]] = true;
+      }
+    }
+    std::vector<bool> removed_right(size());
+    std::vector<size_t> new_left_index(size()), new_right_index(size());
+    for (size_t i = 0, count = 0; i < size(); ++i) {
+      new_left_index[i] = count;
+      count += !removed_left[i];
+      if (removed_left[i]) {
+        removed_right[left_flips[i]] = true;
+      }
+    }
+    for (size_t i = 0, count = 0; i < size(); ++i) {
+      new_right_index[i] = count;
+      count += !removed_right[i];
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < size(); ++i) {
+      if (!removed_left[i]) {
+        if (kept != i) {
+          lefts[kept] = std::move(lefts[i]);
+        }
+        left_flips[kept] = new_right_index[left_flips[i]];
+        ++kept;
+      }
+    }
+    kept = 0;
+    for (size_t i = 0; i < size(); ++i) {
+      if (!removed_right[i]) {
+        if (kept != i) {
+          rights[kept] = std::move(rights[i]);
+        }
+        right_flips[kept] = new_left_index[right_flips[i]];
+        ++kept;
+      }
+    }
+    lefts.erase(lefts.begin() + kept, lefts.end());
+    left_flips.resize(kept);
+    rights.erase(rights.begin() + kept, rights.end());
+    right_flips.resize(kept);
+  }
+
+  // Pairs are identified by their left position for the existing ones and by
+  // size() plus their position in the batch for the added ones. Both sides are
+  // merged as sequences of such ids, then keys and cross positions are laid
+  // out from them.
+  void merge_batch(std::vector<left_t>& added_lefts, std::vector<right_t>& added_rights) {
+    std::vector<size_t> left_order, left_groups, right_order, right_groups;
+    size_t left_count = bimap_impl::sort_by_key(added_lefts.size(), [&](size_t index) -> left_t const& {
+      return added_lefts[index];
+    }, compare_left, left_order, left_groups);
+    size_t right_count = bimap_impl::sort_by_key(added_rights.size(), [&](size_t index) -> right_t const& {
+      return added_rights[index];
+    }, compare_right, right_order, right_groups);
+
+    std::vector<bool> left_taken(left_count), right_taken(right_count);
+    for (size_t i = 0; i < left_order.size(); ++i) {
+      if (i == 0 || left_groups[left_order[i - 1]] != left_groups[left_order[i]]) {
+        left_taken[left_groups[left_order[i]]] = this->template find_index<left_tag>(added_lefts[left_order[i]]) != size();
+      }
+    }
+    for (size_t i = 0; i < right_order.size(); ++i) {
+      if (i == 0 || right_groups[right_order[i - 1]] != right_groups[right_order[i]]) {
+        right_taken[right_groups[right_order[i]]] = this->template find_index<right_tag>(added_rights[right_order[i]]) != size();
+      }
+    }
+    std::vector<bool> accepted(added_lefts.size());
+    for (size_t i = 0; i < added_lefts.size(); ++i) {
+      if (!left_taken[left_groups[i]] && !right_taken[right_groups[i]]) {
+        left_taken[left_groups[i]] = true;
+        right_taken[right_groups[i]] = true;
+        accepted[i] = true;
+      }
+    }
+
+    size_t old_size = size();
+    auto left_of = [&](size_t id) -> left_t& {
+      return id < old_size ? lefts[id] : added_lefts[id - old_size];
+    };
+    auto right_of = [&](size_t id) -> right_t& {
+      return id < old_size ? rights[left_flips[id]] : added_rights[id - old_size];
+    };
+
+    std::vector<size_t> existing(old_size), added;
+    std::iota(existing.begin(), existing.end(), 0);
+    for (size_t index : left_order) {
+      if (accepted[index]) {
+        added.push_back(old_size + index);
+      }
+    }
+    std::vector<size_t> left_ids(old_size + added.size());
+    std::merge(existing.begin(), existing.end(), added.begin(), added.end(), left_ids.begin(),
+               [&](size_t a, size_t b) { return compare_left(left_of(a), left_of(b)); });
+
+    existing = right_flips;
+    added.clear();
+    for (size_t index : right_order) {
+      if (accepted[index]) {
+        added.push_back(old_size + index);
+      }
+    }
+    std::vector<size_t> right_ids(left_ids.size());
+    std::merge(existing.begin(), existing.end(), added.begin(), added.end(), right_ids.begin(),
+               [&](size_t a, size_t b) { return compare_right(right_of(a), right_of(b)); });
+
+    size_t total = left_ids.size();
+    std::vector<size_t> left_position(old_size + added_lefts.size());
+    std::vector<size_t> right_position(old_size + added_lefts.size());
+    for (size_t i = 0; i < total; ++i) {
+      left_position[left_ids[i]] = i;
+      right_position[right_ids[i]] = i;
+    }
+    std::vector<left_t> merged_lefts;
+    std::vector<right_t> merged_rights;
+    std::vector<size_t> merged_left_flips(total), merged_right_flips(total);
+    merged_lefts.reserve(total);
+    merged_rights.reserve(total);
+    for (size_t i = 0; i < total; ++i) {
+      merged_lefts.push_back(move_if_both_noexcept(left_of(left_ids[i])));
+      merged_left_flips[i] = right_position[left_ids[i]];
+    }
+    for (size_t i = 0; i < total; ++i) {
+      merged_rights.push_back(move_if_both_noexcept(right_of(right_ids[i])));
+      merged_right_flips[i] = left_position[right_ids[i]];
+    }
+
+    lefts.swap(merged_lefts);
+    rights.swap(merged_rights);
+    left_flips.swap(merged_left_flips);
+    right_flips.swap(merged_right_flips);
+  }
+
+  // Keys are moved into the merged arrays only if no key of either side can
+  // throw on the way, otherwise a failure while building the rights would
+  // leave the lefts moved out. Copies leave the bimap as it was.
+  template <typename T>
+  static std::conditional_t<std::is_nothrow_move_constructible_v<left_t> &&
+                                std::is_nothrow_move_constructible_v<right_t>,
+                            T&&, T const&>
+  move_if_both_noexcept(T& key) noexcept {
+    return std::move(key);
+  }
+
+  friend base_t;
+
+  template <typename Owner_, typename Value_, typename Tag_, typename FlipValue_, typename FlipTag_>
+  friend struct bimap_impl::array_iterator;
+
+  std::vector<left_t> lefts;
+  std::vector<size_t> left_flips;
+  std::vector<right_t> rights;
+  std::vector<size_t> right_flips;
+  [[no_unique_address]] CompareLeft compare_left;
+  [[no_unique_address]] CompareRight compare_right;
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "tree.h"
+#include "wide-index.h"
+#include <cstddef>
+#include <vector>
+
+namespace bimap_impl {
+  // Number of trailing one bits of k plus one, i.e. how many levels an
+  // Eytzinger search has to climb back after its last right turn.
+  inline unsigned climb_levels(size_t k) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_ctzll(~static_cast<unsigned long long>(k))) + 1;
+#else
+    unsigned levels = 1;
+    for (; k & 1; k >>= 1) {
+      ++levels;
+    }
+    return levels;
+#endif
+  }
+
+  // Read-only copy of the keys of one tree in Eytzinger (breadth first)
+  // order: the root is at 1 and the children of k are at 2k and 2k + 1, so
+  // the first levels of every search share a few cache lines and the lines
+  // a search will need a few levels later can be prefetched. Keys live at
+  // keys[k - 1], nodes[k] is the tree node holding them and nodes[0] is the
+  // end of the tree, which is where a search that never turned left lands.
+  template <typename T, typename Compare, typename Tag>
+  struct frozen_index {
+  private:
+    using node_t = tree_node<T, Tag>;
+    using node_base_t = tree_base_node;
+    using tree_t = tree<T, Compare, Tag>;
+
+    // Descendants of k that are log2(prefetch_step) levels below it are
+    // consecutive and fill one cache line, so one prefetch covers all of them.
+    static constexpr size_t prefetch_step = [] {
+      size_t step = 2;
+      while (step * 2 * sizeof(T) <= 64) {
+        step *= 2;
+      }
+      return step;
+    }();
+
+  public:
+    frozen_index(tree_t const& tree, size_t size)
+        : nodes(size + 1), compare(tree.get_comparator()) {
+      nodes[0] = tree.get_end();
+      node_base_t* point = tree.get_begin();
+      place(1, point);
+      keys.reserve(size);
+      for (size_t k = 1; k <= size; ++k) {
+        keys.push_back(static_cast<node_t*>(nodes[k])->value());
+      }
+    }
+
+    template <typename Key>
+    node_base_t* lower_bound(Key const& key) const {
+      return nodes[search(key, [this](T const& value, Key const& target) {
+        return compare(value, target);
+      })];
+    }
+
+    template <typename Key>
+    node_base_t* upper_bound(Key const& key) const {
+      return nodes[search(key, [this](T const& value, Key const& target) {
+        return !compare(target, value);
+      })];
+    }
+
+    template <typename Key>
+    node_base_t* find(Key const& key) const {
+      size_t k = search(key, [this](T const& value, Key const& target) {
+        return compare(value, target);
+      });
+      return k == 0 || compare(key, keys[k - 1]) ? nodes[0] : nodes[k];
+    }
+
+  private:
+    // In-order walk over the implicit tree, taking nodes from the real one.
+    void place(size_t k, node_base_t*& point) {
+      if (k >= nodes.size()) {
+        return;
+      }
+      place(2 * k, point);
+      nodes[k] = point;
+      point = tree_t::next(point);
+      place(2 * k + 1, point);
+    }
+
+    // Descends while go_right holds and returns the last node where the
+    // search went left, i.e. the first key for which go_right fails.
+    template <typename Key, typename GoRight>
+    size_t search(Key const& key, GoRight go_right) const {
+      size_t size = keys.size();
+      size_t k = 1;
+      while (k <= size) {
+        if (k * prefetch_step <= size) {
+          prefetch(keys.data() + (k * prefetch_step - 1));
+        }
+        k = 2 * k + go_right(keys[k - 1], key);
+      }
+      return k >> climb_levels(k);
+    }
+
+    std::vector<T> keys;
+    std::vector<node_base_t*> nodes;
+    [[no_unique_address]] Compare compare;
+  };
+
+  // Integral keys under std::less or std::greater are searched with vector
+  // compares of whole blocks, everything else goes through the Eytzinger order.
+  template <typename T, typename Compare, typename Tag>
+  using frozen_index_t = std::conditional_t<has_wide_index_v<T, Compare>, wide_index<T, Compare, Tag>,
+                                            frozen_index<T, Compare, Tag>>;
+}
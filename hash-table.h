@@ -0,0 +1,237 @@
+#pragma once
+
+#include "tree.h"
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace bimap_impl {
+  template <typename Hash, typename Equal>
+  inline constexpr bool is_transparent_hash_v = is_transparent_v<Hash> && is_transparent_v<Equal>;
+
+  // Whether Key may be looked up on a side of Value keys hashed by Hash.
+  template <typename Key, typename Value, typename Hash, typename Equal>
+  inline constexpr bool is_hash_key_v = is_same_key_v<Key, Value> || is_transparent_hash_v<Hash, Equal>;
+
+  struct hash_base_node {
+    hash_base_node* next{nullptr};
+    uint64_t hash{0};
+  };
+
+
+  template <typename T, typename Tag>
+  struct hash_node : hash_base_node {
+    template <typename Arg>
+    hash_node(Arg&& value_)
+        : value_(std::forward<Arg>(value_)) {}
+
+    template <typename... Args>
+    hash_node(std::piecewise_construct_t, std::tuple<Args...> args)
+        : value_(std::make_from_tuple<T>(std::move(args))) {}
+
+    T const& value() noexcept {
+      return value_;
+    }
+
+  private:
+    T value_;
+  };
+
+
+  // Chained hash table over nodes it does not own. All nodes form one singly
+  // linked list in which the nodes of a bucket are adjacent, and a bucket
+  // points to the node before its first one, so a node is unlinked without
+  // a back link and iteration is a walk along the list. Nodes keep their
+  // hash, which spares rehashing keys when the table grows and most calls of
+  // Equal on a collision.
+  template <typename T, typename Hash, typename Equal, typename Tag>
+  struct hash_table {
+  private:
+    using node_t = hash_node<T, Tag>;
+    using node_base_t = hash_base_node;
+
+    static constexpr size_t min_bucket_count = 16;
+
+  public:
+    hash_table() = default;
+
+    hash_table(Hash&& hash, Equal&& equal) noexcept
+        : hash(std::move(hash)),
+          equal(std::move(equal)) {}
+
+    hash_table(hash_table const&) = delete;
+    hash_table& operator=(hash_table const&) = delete;
+
+    // std::hash is the identity for integers, the multiplication moves all
+    // of their bits into the high ones, which select the bucket.
+    template <typename Key>
+    uint64_t hash_of(Key const& key) const {
+      return static_cast<uint64_t>(hash(key)) * 0x9E3779B97F4A7C15ull;
+    }
+
+    template <typename Key>
+    node_t* find(Key const& key) const {
+      return find(key, hash_of(key));
+    }
+
+    template <typename Key>
+    node_t* find(Key const& key, uint64_t key_hash) const {
+      if (buckets.empty()) {
+        return nullptr;
+      }
+      size_t bucket = bucket_of(key_hash);
+      node_base_t* before = buckets[bucket];
+      if (before == nullptr) {
+        return nullptr;
+      }
+      for (node_base_t* point = before->next; point != nullptr && bucket_of(point->hash) == bucket;
+           point = point->next) {
+        if (point->hash == key_hash && equal(static_cast<node_t*>(point)->value(), key)) {
+          return static_cast<node_t*>(point);
+        }
+      }
+      return nullptr;
+    }
+
+    // Makes room for count nodes, after which linking up to that many never
+    // allocates or throws.
+    void reserve(size_t count) {
+      if (count <= buckets.size()) {
+        return;
+      }
+      size_t bucket_count = std::max(buckets.size(), min_bucket_count);
+      while (bucket_count < count) {
+        bucket_count *= 2;
+      }
+      rehash(bucket_count);
+    }
+
+    // The hash of the node has to be set and there has to be room for it.
+    void link(node_base_t* node) noexcept {
+      size_t bucket = bucket_of(node->hash);
+      node_base_t* before = buckets[bucket];
+      if (before != nullptr) {
+        node->next = before->next;
+        before->next = node;
+      } else {
+        node->next = head.next;
+        head.next = node;
+        if (node->next != nullptr) {
+          buckets[bucket_of(node->next->hash)] = node;
+        }
+        buckets[bucket] = &head;
+      }
+      ++node_count;
+    }
+
+    // Returns the node that followed it.
+    node_base_t* unlink(node_base_t* node) noexcept {
+      size_t bucket = bucket_of(node->hash);
+      node_base_t* before = buckets[bucket];
+      while (before->next != node) {
+        before = before->next;
+      }
+      node_base_t* after = node->next;
+      bool after_elsewhere = after != nullptr && bucket_of(after->hash) != bucket;
+      if (after_elsewhere) {
+        buckets[bucket_of(after->hash)] = before;
+      }
+      if (before == buckets[bucket] && (after == nullptr || after_elsewhere)) {
+        buckets[bucket] = nullptr;
+      }
+      before->next = after;
+      --node_count;
+      return after;
+    }
+
+    template <typename Destroy>
+    void clear(Destroy&& destroy) noexcept {
+      node_base_t* point = head.next;
+      while (point != nullptr) {
+        node_base_t* next = point->next;
+        destroy(static_cast<node_t*>(point));
+        point = next;
+      }
+      reset();
+    }
+
+    void reset() noexcept {
+      head.next = nullptr;
+      std::fill(buckets.begin(), buckets.end(), nullptr);
+      node_count = 0;
+    }
+
+    node_base_t* get_begin() const noexcept {
+      return head.next;
+    }
+
+    size_t size() const noexcept {
+      return node_count;
+    }
+
+    size_t bucket_count() const noexcept {
+      return buckets.size();
+    }
+
+    Hash const& get_hash() const noexcept {
+      return hash;
+    }
+
+    Equal const& get_equal() const noexcept {
+      return equal;
+    }
+
+    bool compare_equal(T const& lhs, T const& rhs) const {
+      return equal(lhs, rhs);
+    }
+
+    // The first bucket points to the head, which stays in its object.
+    void swap(hash_table& other) noexcept {
+      std::swap(head.next, other.head.next);
+      buckets.swap(other.buckets);
+      std::swap(bucket_shift, other.bucket_shift);
+      std::swap(node_count, other.node_count);
+      std::swap(hash, other.hash);
+      std::swap(equal, other.equal);
+      fix_head();
+      other.fix_head();
+    }
+
+  private:
+    size_t bucket_of(uint64_t node_hash) const noexcept {
+      return static_cast<size_t>(node_hash >> bucket_shift);
+    }
+
+    void fix_head() noexcept {
+      if (head.next != nullptr) {
+        buckets[bucket_of(head.next->hash)] = &head;
+      }
+    }
+
+    void rehash(size_t bucket_count) {
+      std::vector<node_base_t*> new_buckets(bucket_count, nullptr);
+      buckets.swap(new_buckets);
+      bucket_shift = 64;
+      for (size_t count = bucket_count; count > 1; count >>= 1) {
+        --bucket_shift;
+      }
+      node_base_t* point = head.next;
+      head.next = nullptr;
+      node_count = 0;
+      while (point != nullptr) {
+        node_base_t* next = point->next;
+        link(point);
+        point = next;
+      }
+    }
+
+    node_base_t head;
+    std::vector<node_base_t*> buckets;
+    unsigned bucket_shift{64};
+    size_t node_count{0};
+    [[no_unique_address]] Hash hash;
+    [[no_unique_address]] Equal equal;
+  };
+}
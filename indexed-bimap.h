@@ -0,0 +1,1056 @@
+#pragma once
+
+#include "hash-table.h"
+#include "tree.h"
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Index policies of indexed_bimap. With void the side uses std::less,
+// std::hash and std::equal_to of its key, otherwise the policy object
+// carries the function objects to use.
+template <typename Compare = void>
+struct ordered_index {
+  Compare compare;
+};
+
+template <>
+struct ordered_index<void> {};
+
+template <typename Hash = void, typename Equal = void>
+struct hashed_index {
+  Hash hash;
+  Equal equal;
+};
+
+template <typename Hash>
+struct hashed_index<Hash, void> {
+  Hash hash;
+};
+
+template <typename Equal>
+struct hashed_index<void, Equal> {
+  Equal equal;
+};
+
+template <>
+struct hashed_index<void, void> {};
+
+namespace bimap_impl {
+  template <typename LeftNode, typename RightNode>
+  struct pair_node : LeftNode, RightNode {
+
+    template <typename ArgLeft, typename ArgRight>
+    pair_node(ArgLeft&& left, ArgRight&& right)
+        : LeftNode(std::forward<ArgLeft>(left)),
+          RightNode(std::forward<ArgRight>(right)) {}
+
+    template <typename... ArgsLeft, typename... ArgsRight>
+    pair_node(std::piecewise_construct_t, std::tuple<ArgsLeft...> left, std::tuple<ArgsRight...> right)
+        : LeftNode(std::piecewise_construct, std::move(left)),
+          RightNode(std::piecewise_construct, std::move(right)) {}
+  };
+
+  // One side of an indexed_bimap: the same operations over a tree or a hash
+  // table. A position is where a key is or would be linked, found by the
+  // lookup that checks the key is free.
+  template <typename Key, typename Index, typename Tag>
+  struct side_index;
+
+  template <typename Key, typename Compare, typename Tag>
+  struct side_index<Key, ordered_index<Compare>, Tag> {
+  private:
+    using compare_t = std::conditional_t<std::is_void_v<Compare>, std::less<Key>, Compare>;
+    using tree_t = tree<Key, compare_t, Tag>;
+
+  public:
+    using node_t = tree_node<Key, Tag>;
+    using node_base_t = tree_base_node;
+    using position_t = insert_position;
+
+    static constexpr bool is_ordered = true;
+
+    template <typename K>
+    static constexpr bool is_key_v = bimap_impl::is_key_v<K, Key, compare_t>;
+
+    explicit side_index(ordered_index<Compare> policy)
+        : index(compare_of(std::move(policy))) {}
+
+    template <typename K>
+    node_t* find(K const& key) const {
+      return index.find(key);
+    }
+
+    template <typename K>
+    position_t find_position(K const& key) const {
+      return index.find_position(key);
+    }
+
+    static bool is_found(position_t const& position) noexcept {
+      return position.found != nullptr;
+    }
+
+    void reserve(size_t) noexcept {}
+
+    void link(position_t const& position, node_t* node) noexcept {
+      index.insert(position, node);
+    }
+
+    node_base_t* unlink(node_t* node) {
+      return index.remove(node);
+    }
+
+    void undo_link(node_t* node) noexcept {
+      index.unlink(node);
+    }
+
+    // A bulk insert sorts the added nodes by key and marks the keys the tree
+    // has in prepare, claims the free keys pair by pair, merges the claimed
+    // nodes with the tree in settle and rebuilds the tree in commit, which is
+    // the only step that changes it.
+    struct bulk_t {
+      std::vector<node_t*> nodes;
+      std::vector<size_t> order, groups;
+      std::vector<bool> taken, claimed;
+      std::vector<node_base_t*> sorted;
+    };
+
+    template <typename Node>
+    void prepare(bulk_t& bulk, std::vector<Node*> const& nodes) const {
+      bulk.nodes.assign(nodes.begin(), nodes.end());
+      auto node_at = [&bulk](size_t i) {
+        return bulk.nodes[i];
+      };
+      size_t runs = sort_by_key(nodes.size(), [&bulk](size_t i) -> Key const& {
+        return bulk.nodes[i]->value();
+      }, index.get_comparator(), bulk.order, bulk.groups);
+      bulk.taken.assign(runs, false);
+      bulk.claimed.assign(nodes.size(), false);
+      index.mark_existing(node_at, bulk.order, bulk.groups, bulk.taken);
+    }
+
+    static bool is_free(bulk_t const& bulk, size_t i) noexcept {
+      return !bulk.taken[bulk.groups[i]];
+    }
+
+    static void claim(bulk_t& bulk, size_t i) noexcept {
+      bulk.taken[bulk.groups[i]] = true;
+      bulk.claimed[i] = true;
+    }
+
+    void settle(bulk_t& bulk) const {
+      index.merge_sorted([&bulk](size_t i) { return bulk.nodes[i]; }, bulk.order, bulk.claimed, bulk.sorted);
+    }
+
+    static void rollback(bulk_t&) noexcept {}
+
+    void commit(bulk_t& bulk) noexcept {
+      assign(bulk.sorted.data(), bulk.sorted.data() + bulk.sorted.size());
+    }
+
+    void assign(node_base_t* const* first, node_base_t* const* last) noexcept {
+      index.assign(first, last);
+    }
+
+    template <typename K>
+    node_base_t* lower_bound(K const& key) const {
+      return index.lower_bound(key);
+    }
+
+    template <typename K>
+    node_base_t* upper_bound(K const& key) const {
+      return index.upper_bound(key);
+    }
+
+    node_base_t* get_begin() const noexcept {
+      return index.get_begin();
+    }
+
+    node_base_t* get_end() const noexcept {
+      return index.get_end();
+    }
+
+    static node_base_t* next(node_base_t* point) noexcept {
+      return tree_t::next(point);
+    }
+
+    static node_base_t* prev(node_base_t* point) noexcept {
+      return tree_t::prev(point);
+    }
+
+    template <typename Destroy>
+    void clear(Destroy&& destroy) noexcept {
+      index.clear(std::forward<Destroy>(destroy));
+    }
+
+    void reset() noexcept {
+      index.reset();
+    }
+
+    bool compare_equal(Key const& lhs, Key const& rhs) const {
+      return index.compare_equal(lhs, rhs);
+    }
+
+    ordered_index<Compare> get_policy() const {
+      if constexpr (std::is_void_v<Compare>) {
+        return {};
+      } else {
+        return {index.get_comparator()};
+      }
+    }
+
+    void swap(side_index& other) noexcept {
+      index.swap(other.index);
+    }
+
+  private:
+    static compare_t compare_of(ordered_index<Compare> policy) {
+      if constexpr (std::is_void_v<Compare>) {
+        return compare_t();
+      } else {
+        return std::move(policy.compare);
+      }
+    }
+
+    tree_t index;
+  };
+
+  template <typename Key, typename Hash, typename Equal, typename Tag>
+  struct side_index<Key, hashed_index<Hash, Equal>, Tag> {
+  private:
+    using hash_t = std::conditional_t<std::is_void_v<Hash>, std::hash<Key>, Hash>;
+    using equal_t = std::conditional_t<std::is_void_v<Equal>, std::equal_to<Key>, Equal>;
+    using table_t = hash_table<Key, hash_t, equal_t, Tag>;
+
+  public:
+    using node_t = hash_node<Key, Tag>;
+    using node_base_t = hash_base_node;
+
+    struct position_t {
+      uint64_t hash;
+      node_t* found;
+    };
+
+    static constexpr bool is_ordered = false;
+
+    template <typename K>
+    static constexpr bool is_key_v = is_hash_key_v<K, Key, hash_t, equal_t>;
+
+    explicit side_index(hashed_index<Hash, Equal> policy)
+        : table(hash_of(policy), equal_of(policy)) {}
+
+    template <typename K>
+    node_t* find(K const& key) const {
+      return table.find(key);
+    }
+
+    template <typename K>
+    position_t find_position(K const& key) const {
+      uint64_t key_hash = table.hash_of(key);
+      return {key_hash, table.find(key, key_hash)};
+    }
+
+    static bool is_found(position_t const& position) noexcept {
+      return position.found != nullptr;
+    }
+
+    void reserve(size_t count) {
+      table.reserve(count);
+    }
+
+    // Needs room reserved for the node.
+    void link(position_t const& position, node_t* node) noexcept {
+      node->hash = position.hash;
+      table.link(node);
+    }
+
+    node_base_t* unlink(node_t* node) noexcept {
+      return table.unlink(node);
+    }
+
+    void undo_link(node_t* node) noexcept {
+      table.unlink(node);
+    }
+
+    // Needs room reserved for the node. The copy keeps the hash of the
+    // original, so its key is not hashed again.
+    void link_copy(node_t* node, node_t const* original) noexcept {
+      node->hash = original->hash;
+      table.link(node);
+    }
+
+    // A bulk insert hashes the added keys in prepare and then checks and
+    // links them pair by pair into the table, which needs room reserved for
+    // all of them, so keys repeated within the batch are caught by the table.
+    // rollback takes the linked nodes out again.
+    struct bulk_t {
+      std::vector<node_t*> nodes;
+      std::vector<uint64_t> hashes;
+      std::vector<node_t*> linked;
+    };
+
+    template <typename Node>
+    void prepare(bulk_t& bulk, std::vector<Node*> const& nodes) const {
+      bulk.nodes.assign(nodes.begin(), nodes.end());
+      bulk.hashes.resize(nodes.size());
+      for (size_t i = 0; i < nodes.size(); ++i) {
+        bulk.hashes[i] = table.hash_of(bulk.nodes[i]->value());
+      }
+      bulk.linked.reserve(nodes.size());
+    }
+
+    bool is_free(bulk_t const& bulk, size_t i) const {
+      return table.find(bulk.nodes[i]->value(), bulk.hashes[i]) == nullptr;
+    }
+
+    void claim(bulk_t& bulk, size_t i) noexcept {
+      link({bulk.hashes[i], nullptr}, bulk.nodes[i]);
+      bulk.linked.push_back(bulk.nodes[i]);
+    }
+
+    static void settle(bulk_t&) noexcept {}
+
+    void rollback(bulk_t& bulk) noexcept {
+      for (node_t* node : bulk.linked) {
+        table.unlink(node);
+      }
+      bulk.linked.clear();
+    }
+
+    static void commit(bulk_t&) noexcept {}
+
+    node_base_t* get_begin() const noexcept {
+      return table.get_begin();
+    }
+
+    node_base_t* get_end() const noexcept {
+      return nullptr;
+    }
+
+    static node_base_t* next(node_base_t* point) noexcept {
+      return point->next;
+    }
+
+    template <typename Destroy>
+    void clear(Destroy&& destroy) noexcept {
+      table.clear(std::forward<Destroy>(destroy));
+    }
+
+    void reset() noexcept {
+      table.reset();
+    }
+
+    bool compare_equal(Key const& lhs, Key const& rhs) const {
+      return table.compare_equal(lhs, rhs);
+    }
+
+    hashed_index<Hash, Equal> get_policy() const {
+      if constexpr (std::is_void_v<Hash> && std::is_void_v<Equal>) {
+        return {};
+      } else if constexpr (std::is_void_v<Equal>) {
+        return {table.get_hash()};
+      } else if constexpr (std::is_void_v<Hash>) {
+        return {table.get_equal()};
+      } else {
+        return {table.get_hash(), table.get_equal()};
+      }
+    }
+
+    void swap(side_index& other) noexcept {
+      table.swap(other.table);
+    }
+
+  private:
+    static hash_t hash_of(hashed_index<Hash, Equal>& policy) {
+      if constexpr (std::is_void_v<Hash>) {
+        return hash_t();
+      } else {
+        return std::move(policy.hash);
+      }
+    }
+
+    static equal_t equal_of(hashed_index<Hash, Equal>& policy) {
+      if constexpr (std::is_void_v<Equal>) {
+        return equal_t();
+      } else {
+        return std::move(policy.equal);
+      }
+    }
+
+    table_t table;
+  };
+}
+
+// bimap whose sides pick their index independently: ordered_index keeps a
+// side in a tree as in bimap, with bounds and ordered iteration, hashed_index
+// keeps it in a chained hash table, with O(1) average lookups
+// and iteration in no particular order. Both indices link the same node per
+// pair, so flip is O(1) whatever the sides are. Iterators of a hashed side
+// are forward only.
+template <typename Left, typename Right,
+          typename LeftIndex = ordered_index<>,
+          typename RightIndex = ordered_index<>,
+          typename Allocator = std::allocator<std::pair<Left, Right>>>
+struct indexed_bimap {
+private:
+  using left_t = Left;
+  using right_t = Right;
+  using left_side_t = bimap_impl::side_index<Left, LeftIndex, bimap_impl::left_tag>;
+  using right_side_t = bimap_impl::side_index<Right, RightIndex, bimap_impl::right_tag>;
+  using left_node_t = typename left_side_t::node_t;
+  using right_node_t = typename right_side_t::node_t;
+  using bimap_node_t = bimap_impl::pair_node<left_node_t, right_node_t>;
+  using node_allocator_t = typename std::allocator_traits<Allocator>::template rebind_alloc<bimap_node_t>;
+  using node_traits = std::allocator_traits<node_allocator_t>;
+
+  static_assert(std::is_same_v<typename node_traits::pointer, bimap_node_t*>,
+                "allocator must use raw pointers");
+
+  template <typename Value, typename Tag, typename FlipValue, typename FlipTag>
+  struct base_iterator;
+
+public:
+  using left_iterator = base_iterator<Left, bimap_impl::left_tag, Right, bimap_impl::right_tag>;
+  using right_iterator = base_iterator<Right, bimap_impl::right_tag, Left, bimap_impl::left_tag>;
+
+  indexed_bimap(LeftIndex left_index = LeftIndex(),
+                RightIndex right_index = RightIndex(),
+                Allocator const& allocator = Allocator())
+      : left_side(std::move(left_index)),
+        right_side(std::move(right_index)),
+        allocator(allocator) {}
+
+  explicit indexed_bimap(Allocator const& allocator)
+      : indexed_bimap(LeftIndex(), RightIndex(), allocator) {}
+
+  template <typename InputIt, typename = bimap_impl::enable_if_pair_iterator_t<InputIt>>
+  indexed_bimap(InputIt first, InputIt last,
+                LeftIndex left_index = LeftIndex(),
+                RightIndex right_index = RightIndex(),
+                Allocator const& allocator = Allocator())
+      : indexed_bimap(std::move(left_index), std::move(right_index), allocator) {
+    insert(first, last);
+  }
+
+  indexed_bimap(indexed_bimap const& other)
+      : indexed_bimap(other.left_side.get_policy(), other.right_side.get_policy(),
+                      node_traits::select_on_container_copy_construction(other.allocator)) {
+    if constexpr (!left_side_t::is_ordered && right_side_t::is_ordered) {
+      copy_from<bimap_impl::right_tag, bimap_impl::left_tag>(other);
+    } else {
+      copy_from<bimap_impl::left_tag, bimap_impl::right_tag>(other);
+    }
+  }
+
+  indexed_bimap(indexed_bimap&& other) noexcept
+      : indexed_bimap(LeftIndex(), RightIndex(), other.allocator) {
+    other.swap(*this);
+  }
+
+  indexed_bimap& operator=(indexed_bimap const& other) {
+    if (this != &other) {
+      indexed_bimap(other).swap(*this);
+    }
+    return *this;
+  }
+
+  indexed_bimap& operator=(indexed_bimap&& other) noexcept {
+    if (this != &other) {
+      indexed_bimap(std::move(other)).swap(*this);
+    }
+    return *this;
+  }
+
+  ~indexed_bimap() {
+    clear();
+  }
+
+
+  left_iterator insert(left_t const& left, right_t const& right) {
+    return insert_impl(left, right);
+  }
+
+  left_iterator insert(left_t const& left, right_t&& right) {
+    return insert_impl(left, std::move(right));
+  }
+
+  left_iterator insert(left_t&& left, right_t const& right) {
+    return insert_impl(std::move(left), right);
+  }
+
+  left_iterator insert(left_t&& left, right_t&& right) {
+    return insert_impl(std::move(left), std::move(right));
+  }
+
+  // Inserts pairs with the same result as inserting them one by one. The
+  // hashed sides are sized once for the whole range, and when the range is
+  // large compared to the bimap the ordered sides are rebuilt from merged
+  // sorted sequences as in bimap. If an exception is thrown, the bimap is
+  // left unchanged.
+  template <typename InputIt, typename = bimap_impl::enable_if_pair_iterator_t<InputIt>>
+  void insert(InputIt first, InputIt last) {
+    std::vector<bimap_node_t*> nodes;
+    try {
+      for (; first != last; ++first) {
+        auto&& pair = *first;
+        nodes.push_back(nullptr);
+        nodes.back() = create_node(std::get<0>(std::forward<decltype(pair)>(pair)),
+                                   std::get<1>(std::forward<decltype(pair)>(pair)));
+      }
+      insert_nodes(nodes);
+    } catch (...) {
+      for (bimap_node_t* node : nodes) {
+        if (node != nullptr) {
+          destroy_node(node);
+        }
+      }
+      throw;
+    }
+  }
+
+
+  left_iterator erase_left(left_iterator it) {
+    return left_iterator(this, remove(switch_node(static_cast<left_node_t*>(it.src_node))).first);
+  }
+
+  bool erase_left(left_t const& left) {
+    return erase_left<left_t>(left);
+  }
+
+  template <typename Key, typename = std::enable_if_t<left_side_t::template is_key_v<Key> &&
+                                                      !std::is_convertible_v<Key, left_iterator>>>
+  bool erase_left(Key const& left) {
+    left_node_t* left_node = left_side.find(left);
+    if (left_node != nullptr) {
+      remove(switch_node(left_node));
+      return true;
+    }
+    return false;
+  }
+
+  right_iterator erase_right(right_iterator it) {
+    return right_iterator(this, remove(switch_node(static_cast<right_node_t*>(it.src_node))).second);
+  }
+
+  bool erase_right(right_t const& right) {
+    return erase_right<right_t>(right);
+  }
+
+  template <typename Key, typename = std::enable_if_t<right_side_t::template is_key_v<Key> &&
+                                                      !std::is_convertible_v<Key, right_iterator>>>
+  bool erase_right(Key const& right) {
+    right_node_t* right_node = right_side.find(right);
+    if (right_node != nullptr) {
+      remove(switch_node(right_node));
+      return true;
+    }
+    return false;
+  }
+
+
+  left_iterator find_left(left_t const& left) const {
+    return find_left<left_t>(left);
+  }
+
+  template <typename Key, typename = std::enable_if_t<left_side_t::template is_key_v<Key>>>
+  left_iterator find_left(Key const& left) const {
+    left_node_t* left_node = left_side.find(left);
+    return left_node != nullptr ? left_iterator(this, left_node) : end_left();
+  }
+
+  right_iterator find_right(right_t const& right) const {
+    return find_right<right_t>(right);
+  }
+
+  template <typename Key, typename = std::enable_if_t<right_side_t::template is_key_v<Key>>>
+  right_iterator find_right(Key const& right) const {
+    right_node_t* right_node = right_side.find(right);
+    return right_node != nullptr ? right_iterator(this, right_node) : end_right();
+  }
+
+
+  right_t const& at_left(left_t const& key) const {
+    return at_left<left_t>(key);
+  }
+
+  template <typename Key, typename = std::enable_if_t<left_side_t::template is_key_v<Key>>>
+  right_t const& at_left(Key const& key) const {
+    left_node_t* left_node = left_side.find(key);
+    if (left_node == nullptr) {
+      throw std::out_of_range("no entry exists");
+    }
+    return static_cast<right_node_t*>(switch_node(left_node))->value();
+  }
+
+  left_t const& at_right(right_t const& key) const {
+    return at_right<right_t>(key);
+  }
+
+  template <typename Key, typename = std::enable_if_t<right_side_t::template is_key_v<Key>>>
+  left_t const& at_right(Key const& key) const {
+    right_node_t* right_node = right_side.find(key);
+    if (right_node == nullptr) {
+      throw std::out_of_range("no entry exists");
+    }
+    return static_cast<left_node_t*>(switch_node(right_node))->value();
+  }
+
+
+  // Bounds exist only for ordered sides.
+  template <typename Side = left_side_t, typename = std::enable_if_t<Side::is_ordered>>
+  left_iterator lower_bound_left(left_t const& left) const {
+    return left_iterator(this, left_side.lower_bound(left));
+  }
+
+  template <typename Key, typename Side = left_side_t,
+            typename = std::enable_if_t<Side::is_ordered && !std::is_same_v<Key, left_t> &&
+                                        Side::template is_key_v<Key>>>
+  left_iterator lower_bound_left(Key const& left) const {
+    return left_iterator(this, left_side.lower_bound(left));
+  }
+
+  template <typename Side = left_side_t, typename = std::enable_if_t<Side::is_ordered>>
+  left_iterator upper_bound_left(left_t const& left) const {
+    return left_iterator(this, left_side.upper_bound(left));
+  }
+
+  template <typename Key, typename Side = left_side_t,
+            typename = std::enable_if_t<Side::is_ordered && !std::is_same_v<Key, left_t> &&
+                                        Side::template is_key_v<Key>>>
+  left_iterator upper_bound_left(Key const& left) const {
+    return left_iterator(this, left_side.upper_bound(left));
+  }
+
+
+  template <typename Side = right_side_t, typename = std::enable_if_t<Side::is_ordered>>
+  right_iterator lower_bound_right(right_t const& right) const {
+    return right_iterator(this, right_side.lower_bound(right));
+  }
+
+  template <typename Key, typename Side = right_side_t,
+            typename = std::enable_if_t<Side::is_ordered && !std::is_same_v<Key, right_t> &&
+                                        Side::template is_key_v<Key>>>
+  right_iterator lower_bound_right(Key const& right) const {
+    return right_iterator(this, right_side.lower_bound(right));
+  }
+
+  template <typename Side = right_side_t, typename = std::enable_if_t<Side::is_ordered>>
+  right_iterator upper_bound_right(right_t const& right) const {
+    return right_iterator(this, right_side.upper_bound(right));
+  }
+
+  template <typename Key, typename Side = right_side_t,
+            typename = std::enable_if_t<Side::is_ordered && !std::is_same_v<Key, right_t> &&
+                                        Side::template is_key_v<Key>>>
+  right_iterator upper_bound_right(Key const& right) const {
+    return right_iterator(this, right_side.upper_bound(right));
+  }
+
+
+  left_iterator begin_left() const {
+    return left_iterator(this, left_side.get_begin());
+  }
+
+  left_iterator end_left() const {
+    return left_iterator(this, left_side.get_end());
+  }
+
+
+  right_iterator begin_right() const {
+    return right_iterator(this, right_side.get_begin());
+  }
+
+  right_iterator end_right() const {
+    return right_iterator(this, right_side.get_end());
+  }
+
+
+  // Sizes the hashed sides for count pairs, so that inserting up to that
+  // many does not rehash them.
+  void reserve(size_t count) {
+    left_side.reserve(count);
+    right_side.reserve(count);
+  }
+
+  void clear() noexcept {
+    left_side.clear([this](left_node_t* node) {
+      destroy_node(switch_node(node));
+    });
+    right_side.reset();
+    pair_count = 0;
+  }
+
+  bool empty() const {
+    return pair_count == 0;
+  }
+
+  size_t size() const {
+    return pair_count;
+  }
+
+  Allocator get_allocator() const {
+    return Allocator(allocator);
+  }
+
+
+  friend bool operator==(indexed_bimap const& a, indexed_bimap const& b) {
+    return a.compare_equal(b);
+  }
+
+  friend bool operator!=(indexed_bimap const& a, indexed_bimap const& b) {
+    return !a.compare_equal(b);
+  }
+
+  void swap(indexed_bimap& other) noexcept {
+    left_side.swap(other.left_side);
+    right_side.swap(other.right_side);
+    std::swap(allocator, other.allocator);
+    std::swap(pair_count, other.pair_count);
+  }
+
+private:
+  static bimap_node_t* switch_node(left_node_t* node) noexcept {
+    return static_cast<bimap_node_t*>(node);
+  }
+
+  static bimap_node_t* switch_node(right_node_t* node) noexcept {
+    return static_cast<bimap_node_t*>(node);
+  }
+
+  template <typename Tag>
+  auto const& get_side() const noexcept {
+    if constexpr (std::is_same_v<Tag, bimap_impl::left_tag>) {
+      return left_side;
+    } else {
+      return right_side;
+    }
+  }
+
+  template <typename Tag>
+  auto& get_side() noexcept {
+    if constexpr (std::is_same_v<Tag, bimap_impl::left_tag>) {
+      return left_side;
+    } else {
+      return right_side;
+    }
+  }
+
+  // Pairs of a are looked up in b by left key, which is O(1) or O(log n)
+  // depending on the left index.
+  bool compare_equal(indexed_bimap const& other) const {
+    if (size() != other.size()) {
+      return false;
+    }
+    for (left_iterator it = begin_left(); it != end_left(); ++it) {
+      left_node_t* other_node = other.left_side.find(*it);
+      if (other_node == nullptr ||
+          !right_side.compare_equal(*it.flip(), static_cast<right_node_t*>(switch_node(other_node))->value())) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Ordered sides are rebuilt from sorted sequences and hashed sides take
+  // the hashes of the originals, so no key is compared or hashed again.
+  // The copies are made in the order of the Tag side of other; the FlipTag
+  // side needs a table from the originals to their copies only when it is
+  // ordered too.
+  template <typename Tag, typename FlipTag>
+  void copy_from(indexed_bimap const& other) {
+    using side_t = std::decay_t<decltype(get_side<Tag>())>;
+    using flip_side_t = std::decay_t<decltype(get_side<FlipTag>())>;
+    using copy_t = std::pair<bimap_node_t*, bimap_node_t*>;
+
+    size_t count = other.size();
+    std::vector<copy_t> copies;
+    std::vector<bimap_impl::tree_base_node*> order;
+    std::unordered_map<bimap_node_t const*, bimap_node_t*> copy_of;
+    copies.reserve(count);
+    if constexpr (side_t::is_ordered || flip_side_t::is_ordered) {
+      order.resize(count);
+    }
+    reserve(count);
+    try {
+      if constexpr (flip_side_t::is_ordered) {
+        copy_of.reserve(count);
+      }
+      auto const& source = other.template get_side<Tag>();
+      for (auto point = source.get_begin(); point != source.get_end(); point = side_t::next(point)) {
+        bimap_node_t* original = switch_node(static_cast<typename side_t::node_t*>(point));
+        copies.emplace_back(original, nullptr);
+        copies.back().second = create_node(static_cast<left_node_t*>(original)->value(),
+                                           static_cast<right_node_t*>(original)->value());
+        if constexpr (flip_side_t::is_ordered) {
+          copy_of.emplace(original, copies.back().second);
+        }
+      }
+    } catch (...) {
+      for (copy_t& copy : copies) {
+        if (copy.second != nullptr) {
+          destroy_node(copy.second);
+        }
+      }
+      throw;
+    }
+
+    link_copies<Tag>(copies, order);
+    if constexpr (flip_side_t::is_ordered) {
+      auto const& source = other.template get_side<FlipTag>();
+      size_t index = 0;
+      for (auto point = source.get_begin(); point != source.get_end(); point = flip_side_t::next(point)) {
+        bimap_node_t* original = switch_node(static_cast<typename flip_side_t::node_t*>(point));
+        order[index++] = static_cast<typename flip_side_t::node_t*>(copy_of.find(original)->second);
+      }
+      get_side<FlipTag>().assign(order.data(), order.data() + count);
+    } else {
+      link_copies<FlipTag>(copies, order);
+    }
+    pair_count = count;
+  }
+
+  // Links copies into the Tag side, in their order if it is ordered.
+  template <typename Tag>
+  void link_copies(std::vector<std::pair<bimap_node_t*, bimap_node_t*>> const& copies,
+                   std::vector<bimap_impl::tree_base_node*>& order) noexcept {
+    auto& side = get_side<Tag>();
+    using side_t = std::decay_t<decltype(side)>;
+    using node_t = typename side_t::node_t;
+    if constexpr (side_t::is_ordered) {
+      for (size_t i = 0; i < copies.size(); ++i) {
+        order[i] = static_cast<node_t*>(copies[i].second);
+      }
+      side.assign(order.data(), order.data() + copies.size());
+    } else {
+      for (auto const& copy : copies) {
+        side.link_copy(static_cast<node_t*>(copy.second), static_cast<node_t*>(copy.first));
+      }
+    }
+  }
+
+  // Takes all nodes: the accepted ones are linked, the rest are destroyed.
+  // Nothing is changed if an exception is thrown, the nodes are left to the
+  // caller.
+  void insert_nodes(std::vector<bimap_node_t*>& nodes) {
+    reserve(size() + nodes.size());
+    std::vector<bool> accepted(nodes.size());
+    if (prefers_one_by_one(nodes.size())) {
+      link_one_by_one(nodes, accepted);
+    } else {
+      link_bulk(nodes, accepted);
+    }
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      if (!accepted[i]) {
+        destroy_node(nodes[i]);
+      }
+    }
+    nodes.clear();
+  }
+
+  // Whether count lookups cost less than walking the ordered sides. With
+  // hashed sides only, lookups are O(1) and always win.
+  bool prefers_one_by_one(size_t count) const noexcept {
+    if constexpr (!left_side_t::is_ordered && !right_side_t::is_ordered) {
+      return true;
+    } else {
+      size_t depth = 1;
+      for (size_t n = size(); n > 1; n >>= 1) {
+        ++depth;
+      }
+      return count * depth < size();
+    }
+  }
+
+  // Pairs linked before an exception are taken out again.
+  void link_one_by_one(std::vector<bimap_node_t*> const& nodes, std::vector<bool>& accepted) {
+    size_t i = 0;
+    try {
+      for (; i < nodes.size(); ++i) {
+        left_node_t* left_node = nodes[i];
+        right_node_t* right_node = nodes[i];
+        typename left_side_t::position_t left_position = left_side.find_position(left_node->value());
+        if (left_side_t::is_found(left_position)) {
+          continue;
+        }
+        typename right_side_t::position_t right_position = right_side.find_position(right_node->value());
+        if (right_side_t::is_found(right_position)) {
+          continue;
+        }
+        left_side.link(left_position, left_node);
+        right_side.link(right_position, right_node);
+        accepted[i] = true;
+        ++pair_count;
+      }
+    } catch (...) {
+      while (i-- > 0) {
+        if (accepted[i]) {
+          left_side.undo_link(nodes[i]);
+          right_side.undo_link(nodes[i]);
+          --pair_count;
+        }
+      }
+      throw;
+    }
+  }
+
+  // Claims the keys of each pair in order on both sides. Only the hashed
+  // sides change before the ordered ones are settled, and they are rolled
+  // back if anything throws.
+  void link_bulk(std::vector<bimap_node_t*> const& nodes, std::vector<bool>& accepted) {
+    typename left_side_t::bulk_t left_bulk;
+    typename right_side_t::bulk_t right_bulk;
+    left_side.prepare(left_bulk, nodes);
+    right_side.prepare(right_bulk, nodes);
+    size_t accepted_count = 0;
+    try {
+      for (size_t i = 0; i < nodes.size(); ++i) {
+        if (left_side.is_free(left_bulk, i) && right_side.is_free(right_bulk, i)) {
+          left_side.claim(left_bulk, i);
+          right_side.claim(right_bulk, i);
+          accepted[i] = true;
+          ++accepted_count;
+        }
+      }
+      left_side.settle(left_bulk);
+      right_side.settle(right_bulk);
+    } catch (...) {
+      left_side.rollback(left_bulk);
+      right_side.rollback(right_bulk);
+      throw;
+    }
+    left_side.commit(left_bulk);
+    right_side.commit(right_bulk);
+    pair_count += accepted_count;
+  }
+
+  template <typename... Args>
+  bimap_node_t* create_node(Args&&... args) {
+    bimap_node_t* node = node_traits::allocate(allocator, 1);
+    try {
+      node_traits::construct(allocator, node, std::forward<Args>(args)...);
+    } catch (...) {
+      node_traits::deallocate(allocator, node, 1);
+      throw;
+    }
+    return node;
+  }
+
+  void destroy_node(bimap_node_t* node) noexcept {
+    node_traits::destroy(allocator, node);
+    node_traits::deallocate(allocator, node, 1);
+  }
+
+  // The hashed sides are grown before the node is created, so once it
+  // exists nothing can throw.
+  template <typename ArgLeft, typename ArgRight>
+  left_iterator insert_impl(ArgLeft&& left, ArgRight&& right) {
+    typename left_side_t::position_t left_position = left_side.find_position(left);
+    if (left_side_t::is_found(left_position)) {
+      return end_left();
+    }
+    typename right_side_t::position_t right_position = right_side.find_position(right);
+    if (right_side_t::is_found(right_position)) {
+      return end_left();
+    }
+    reserve(size() + 1);
+    bimap_node_t* node = create_node(std::forward<ArgLeft>(left), std::forward<ArgRight>(right));
+    left_side.link(left_position, node);
+    right_side.link(right_position, node);
+    ++pair_count;
+    return left_iterator(this, static_cast<left_node_t*>(node));
+  }
+
+  std::pair<typename left_side_t::node_base_t*, typename right_side_t::node_base_t*>
+  remove(bimap_node_t* node) {
+    auto left_next = left_side.unlink(node);
+    auto right_next = right_side.unlink(node);
+    destroy_node(node);
+    --pair_count;
+    return {left_next, right_next};
+  }
+
+  template <typename Value, typename Tag, typename FlipValue, typename FlipTag>
+  struct base_iterator {
+  private:
+    using value_t = Value;
+    using side_t = std::conditional_t<std::is_same_v<Tag, bimap_impl::left_tag>, left_side_t, right_side_t>;
+    using flip_side_t = std::conditional_t<std::is_same_v<Tag, bimap_impl::left_tag>, right_side_t, left_side_t>;
+    using node_t = typename side_t::node_t;
+    using node_base_t = typename side_t::node_base_t;
+    using flip_iterator = base_iterator<FlipValue, FlipTag, Value, Tag>;
+
+  public:
+    base_iterator() = default;
+
+    value_t const& operator*() const {
+      return static_cast<node_t*>(src_node)->value();
+    }
+
+    value_t const* operator->() const {
+      return &static_cast<node_t*>(src_node)->value();
+    }
+
+
+    base_iterator& operator++() {
+      src_node = side_t::next(src_node);
+      return *this;
+    }
+
+    base_iterator operator++(int) {
+      base_iterator old(*this);
+      ++(*this);
+      return old;
+    }
+
+
+    base_iterator& operator--() {
+      src_node = side_t::prev(src_node);
+      return *this;
+    }
+
+    base_iterator operator--(int) {
+      base_iterator old(*this);
+      --(*this);
+      return old;
+    }
+
+
+    flip_iterator flip() const {
+      if (src_node == owner->template get_side<Tag>().get_end()) {
+        return flip_iterator(owner, owner->template get_side<FlipTag>().get_end());
+      }
+      return flip_iterator(owner, static_cast<typename flip_side_t::node_t*>(
+                                      switch_node(static_cast<node_t*>(src_node))));
+    }
+
+
+    friend bool operator==(base_iterator const& lhs, base_iterator const& rhs) {
+      return lhs.src_node == rhs.src_node;
+    }
+
+    friend bool operator!=(base_iterator const& lhs, base_iterator const& rhs) {
+      return lhs.src_node != rhs.src_node;
+    }
+
+
+    template <typename Left_, typename Right_,
+              typename LeftIndex_, typename RightIndex_, typename Allocator_>
+    friend struct indexed_bimap;
+
+  private:
+    base_iterator(indexed_bimap const* owner, node_base_t* src_node) noexcept
+        : owner(owner), src_node(src_node) {}
+
+    indexed_bimap const* owner{nullptr};
+    node_base_t* src_node{nullptr};
+  };
+
+  left_side_t left_side;
+  right_side_t right_side;
+  [[no_unique_address]] node_allocator_t allocator;
+  size_t pair_count{0};
+};
@@ -0,0 +1,218 @@
+#pragma once
+
+#include "bimap-file.h"
+#include "sorted-array.h"
+#include "tree.h"
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+
+// Read-only bimap over memory holding what bimap::save wrote, for example a
+// mapped file. Nothing is copied or converted: lookups are binary searches
+// over the sorted sections of the data and flip follows the stored
+// positions. The header is checked and so are the stored positions, in one
+// sequential pass at open, so a corrupt file cannot make flip read outside
+// the data. The order of the keys is trusted to be what save wrote with the
+// same comparators. The memory has to be aligned at least like uint64_t and
+// the keys, and has to outlive the view and its iterators.
+template <typename Left, typename Right,
+          typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>>
+struct mapped_bimap : bimap_impl::sorted_array_sides<mapped_bimap<Left, Right, CompareLeft, CompareRight>> {
+private:
+  using left_t = Left;
+  using right_t = Right;
+  using left_tag = bimap_impl::left_tag;
+  using right_tag = bimap_impl::right_tag;
+  using left_record_t = bimap_impl::file_record<Left>;
+  using right_record_t = bimap_impl::file_record<Right>;
+  using base_t = bimap_impl::sorted_array_sides<mapped_bimap>;
+
+public:
+  using left_iterator = bimap_impl::array_iterator<mapped_bimap, Left, left_tag, Right, right_tag>;
+  using right_iterator = bimap_impl::array_iterator<mapped_bimap, Right, right_tag, Left, left_tag>;
+
+  // Throws std::runtime_error if data does not start with a header for these
+  // key types, is shorter than the header says or holds a position past the
+  // end of a side.
+  mapped_bimap(void const* data, size_t size,
+               CompareLeft compare_left = CompareLeft(),
+               CompareRight compare_right = CompareRight())
+      : compare_left(std::move(compare_left)),
+        compare_right(std::move(compare_right)) {
+    char const* bytes = static_cast<char const*>(data);
+    if (size < sizeof(bimap_impl::file_header)) {
+      throw std::runtime_error("truncated bimap file");
+    }
+    if (reinterpret_cast<uintptr_t>(bytes) % alignof(bimap_impl::file_header) != 0) {
+      throw std::runtime_error("misaligned bimap file");
+    }
+    bimap_impl::file_header const& header = *reinterpret_cast<bimap_impl::file_header const*>(bytes);
+    bimap_impl::check_file_header<Left, Right>(header, size);
+    if (reinterpret_cast<uintptr_t>(bytes) % alignof(left_record_t) != 0 ||
+        reinterpret_cast<uintptr_t>(bytes) % alignof(right_record_t) != 0) {
+      throw std::runtime_error("misaligned bimap file");
+    }
+    count = header.count;
+    lefts = reinterpret_cast<left_record_t const*>(bytes + header.left_offset);
+    rights = reinterpret_cast<right_record_t const*>(bytes + header.right_offset);
+    for (size_t i = 0; i < count; ++i) {
+      if (lefts[i].position >= count || rights[i].position >= count) {
+        throw std::runtime_error("corrupt bimap file");
+      }
+    }
+  }
+
+
+  left_iterator find_left(left_t const& left) const {
+    return find_left<left_t>(left);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+  left_iterator find_left(Key const& left) const {
+    return left_iterator(this, this->template find_index<left_tag>(left));
+  }
+
+  right_iterator find_right(right_t const& right) const {
+    return find_right<right_t>(right);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+  right_iterator find_right(Key const& right) const {
+    return right_iterator(this, this->template find_index<right_tag>(right));
+  }
+
+
+  right_t const& at_left(left_t const& key) const {
+    return at_left<left_t>(key);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+  right_t const& at_left(Key const& key) const {
+    left_iterator it = find_left(key);
+    if (it == end_left()) {
+      throw std::out_of_range("no entry exists");
+    }
+    return *it.flip();
+  }
+
+  left_t const& at_right(right_t const& key) const {
+    return at_right<right_t>(key);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+  left_t const& at_right(Key const& key) const {
+    right_iterator it = find_right(key);
+    if (it == end_right()) {
+      throw std::out_of_range("no entry exists");
+    }
+    return *it.flip();
+  }
+
+
+  left_iterator lower_bound_left(const left_t& left) const {
+    return lower_bound_left<left_t>(left);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+  left_iterator lower_bound_left(Key const& left) const {
+    return left_iterator(this, this->template lower_index<left_tag>(left));
+  }
+
+  left_iterator upper_bound_left(const left_t& left) const {
+    return upper_bound_left<left_t>(left);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+  left_iterator upper_bound_left(Key const& left) const {
+    return left_iterator(this, this->template upper_index<left_tag>(left));
+  }
+
+
+  right_iterator lower_bound_right(const right_t& right) const {
+    return lower_bound_right<right_t>(right);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+  right_iterator lower_bound_right(Key const& right) const {
+    return right_iterator(this, this->template lower_index<right_tag>(right));
+  }
+
+  right_iterator upper_bound_right(const right_t& right) const {
+    return upper_bound_right<right_t>(right);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+  right_iterator upper_bound_right(Key const& right) const {
+    return right_iterator(this, this->template upper_index<right_tag>(right));
+  }
+
+
+  left_iterator begin_left() const {
+    return left_iterator(this, 0);
+  }
+
+  left_iterator end_left() const {
+    return left_iterator(this, size());
+  }
+
+
+  right_iterator begin_right() const {
+    return right_iterator(this, 0);
+  }
+
+  right_iterator end_right() const {
+    return right_iterator(this, size());
+  }
+
+
+  bool empty() const {
+    return count == 0;
+  }
+
+  size_t size() const {
+    return count;
+  }
+
+private:
+  template <typename Tag>
+  auto get_records() const noexcept {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return lefts;
+    } else {
+      return rights;
+    }
+  }
+
+  template <typename Tag>
+  auto const& get_compare() const noexcept {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return compare_left;
+    } else {
+      return compare_right;
+    }
+  }
+
+  template <typename Tag>
+  auto const& key_at(size_t index) const noexcept {
+    return get_records<Tag>()[index].key;
+  }
+
+  template <typename Tag>
+  size_t flip_at(size_t index) const noexcept {
+    return get_records<Tag>()[index].position;
+  }
+
+  friend base_t;
+
+  template <typename Owner_, typename Value_, typename Tag_, typename FlipValue_, typename FlipTag_>
+  friend struct bimap_impl::array_iterator;
+
+  left_record_t const* lefts{nullptr};
+  right_record_t const* rights{nullptr};
+  size_t count{0};
+  [[no_unique_address]] CompareLeft compare_left;
+  [[no_unique_address]] CompareRight compare_right;
+};
@@ -0,0 +1,62 @@
+#include <algorithm>
+#include <new>
+#include "pool-allocator.h"
+
+namespace bimap_impl {
+
+node_pool::node_pool(size_t chunk_blocks) noexcept
+    : chunk_blocks(std::max<size_t>(chunk_blocks, 1)) {}
+
+node_pool::~node_pool() {
+  while (chunks != nullptr) {
+    chunk_header* next = chunks->next;
+    ::operator delete(static_cast<void*>(chunks), std::align_val_t(block_align));
+    chunks = next;
+  }
+}
+
+void* node_pool::allocate(size_t size, size_t align) {
+  if (block_size == 0) {
+    object_size = size;
+    object_align = align;
+    block_align = std::max(align, alignof(free_block));
+    block_size = (std::max(size, sizeof(free_block)) + block_align - 1) / block_align * block_align;
+  }
+  if (!is_pooled(size, align)) {
+    return ::operator new(size, std::align_val_t(align));
+  }
+  if (free_list != nullptr) {
+    free_block* block = free_list;
+    free_list = block->next;
+    return block;
+  }
+  if (current == current_end) {
+    add_chunk();
+  }
+  void* block = current;
+  current += block_size;
+  return block;
+}
+
+void node_pool::deallocate(void* block, size_t size, size_t align) noexcept {
+  if (!is_pooled(size, align)) {
+    ::operator delete(block, std::align_val_t(align));
+    return;
+  }
+  free_list = new (block) free_block{free_list};
+}
+
+bool node_pool::is_pooled(size_t size, size_t align) const noexcept {
+  return size == object_size && align == object_align;
+}
+
+void node_pool::add_chunk() {
+  size_t header_size = (sizeof(chunk_header) + block_align - 1) / block_align * block_align;
+  char* memory = static_cast<char*>(
+      ::operator new(header_size + chunk_blocks * block_size, std::align_val_t(block_align)));
+  chunks = new (memory) chunk_header{chunks};
+  current = memory + header_size;
+  current_end = current + chunk_blocks * block_size;
+}
+
+}
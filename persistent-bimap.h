@@ -0,0 +1,688 @@
+#pragma once
+
+#include "tree.h"
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace bimap_impl {
+  // Immutable AVL node. Changing a tree builds new nodes for the path to the
+  // change and shares every other subtree with the previous version.
+  template <typename Entry>
+  struct persistent_node {
+    using pointer = std::shared_ptr<persistent_node const>;
+    using entry_pointer = std::shared_ptr<Entry const>;
+
+    persistent_node(pointer left, entry_pointer entry, pointer right) noexcept
+        : left(std::move(left)), right(std::move(right)), entry(std::move(entry)),
+          height(std::max(get_height(this->left), get_height(this->right)) + 1),
+          size(get_size(this->left) + get_size(this->right) + 1) {}
+
+    static size_t get_height(pointer const& node) noexcept {
+      return node == nullptr ? 0 : node->height;
+    }
+
+    static size_t get_size(pointer const& node) noexcept {
+      return node == nullptr ? 0 : node->size;
+    }
+
+    static pointer make(pointer left, entry_pointer entry, pointer right) {
+      return std::make_shared<persistent_node const>(std::move(left), std::move(entry), std::move(right));
+    }
+
+    // Joins two balanced subtrees whose heights differ by at most two.
+    static pointer balance(pointer left, entry_pointer entry, pointer right) {
+      size_t left_height = get_height(left);
+      size_t right_height = get_height(right);
+      if (left_height > right_height + 1) {
+        if (get_height(left->left) >= get_height(left->right)) {
+          return make(left->left, left->entry, make(left->right, std::move(entry), std::move(right)));
+        }
+        pointer const& middle = left->right;
+        return make(make(left->left, left->entry, middle->left), middle->entry,
+                    make(middle->right, std::move(entry), std::move(right)));
+      }
+      if (right_height > left_height + 1) {
+        if (get_height(right->right) >= get_height(right->left)) {
+          return make(make(std::move(left), std::move(entry), right->left), right->entry, right->right);
+        }
+        pointer const& middle = right->left;
+        return make(make(std::move(left), std::move(entry), middle->left), middle->entry,
+                    make(middle->right, right->entry, right->right));
+      }
+      return make(std::move(left), std::move(entry), std::move(right));
+    }
+
+    pointer left;
+    pointer right;
+    entry_pointer entry;
+    size_t height;
+    size_t size;
+  };
+
+
+  // One side of a persistent_bimap: a root and the comparator of the keys
+  // that Tag selects from the shared entries. Copies share all nodes.
+  template <typename Entry, typename Compare, typename Tag>
+  struct persistent_tree {
+  private:
+    using node_t = persistent_node<Entry>;
+    using pointer = typename node_t::pointer;
+    using entry_pointer = typename node_t::entry_pointer;
+
+  public:
+    persistent_tree(Compare&& compare) noexcept
+        : compare(std::move(compare)) {}
+
+    static auto const& key(Entry const& entry) noexcept {
+      if constexpr (std::is_same_v<Tag, left_tag>) {
+        return entry.first;
+      } else {
+        return entry.second;
+      }
+    }
+
+    node_t const* get_root() const noexcept {
+      return root.get();
+    }
+
+    size_t size() const noexcept {
+      return node_t::get_size(root);
+    }
+
+    Compare const& get_comparator() const noexcept {
+      return compare;
+    }
+
+    // Fills path with the nodes from the root down to the first node whose
+    // key is not less than key (or greater than it if strict), which is the
+    // last one in the path. The path is empty if there is no such node.
+    template <typename Key>
+    void bound(Key const& key_, bool strict, std::vector<node_t const*>& path) const {
+      path.clear();
+      size_t length = 0;
+      for (node_t const* point = root.get(); point != nullptr;) {
+        path.push_back(point);
+        bool go_right = strict ? !compare(key_, key(*point->entry)) : compare(key(*point->entry), key_);
+        if (go_right) {
+          point = point->right.get();
+        } else {
+          length = path.size();
+          point = point->left.get();
+        }
+      }
+      path.resize(length);
+    }
+
+    template <typename Key>
+    node_t const* find(Key const& key_) const {
+      node_t const* point = root.get();
+      while (point != nullptr) {
+        if (compare(key_, key(*point->entry))) {
+          point = point->left.get();
+        } else if (compare(key(*point->entry), key_)) {
+          point = point->right.get();
+        } else {
+          break;
+        }
+      }
+      return point;
+    }
+
+    // The key of entry must not be in the tree yet.
+    void insert(entry_pointer entry) {
+      root = insert(root, std::move(entry));
+    }
+
+    // The key must be in the tree.
+    template <typename Key>
+    void erase(Key const& key_) {
+      root = erase(root, key_);
+    }
+
+    void clear() noexcept {
+      root.reset();
+    }
+
+    void swap(persistent_tree& other) noexcept {
+      std::swap(root, other.root);
+      std::swap(compare, other.compare);
+    }
+
+  private:
+    pointer insert(pointer const& point, entry_pointer entry) const {
+      if (point == nullptr) {
+        return node_t::make(nullptr, std::move(entry), nullptr);
+      }
+      if (compare(key(*entry), key(*point->entry))) {
+        return node_t::balance(insert(point->left, std::move(entry)), point->entry, point->right);
+      }
+      return node_t::balance(point->left, point->entry, insert(point->right, std::move(entry)));
+    }
+
+    template <typename Key>
+    pointer erase(pointer const& point, Key const& key_) const {
+      if (compare(key_, key(*point->entry))) {
+        return node_t::balance(erase(point->left, key_), point->entry, point->right);
+      }
+      if (compare(key(*point->entry), key_)) {
+        return node_t::balance(point->left, point->entry, erase(point->right, key_));
+      }
+      if (point->left == nullptr) {
+        return point->right;
+      }
+      if (point->right == nullptr) {
+        return point->left;
+      }
+      node_t const* min = point->right.get();
+      while (min->left != nullptr) {
+        min = min->left.get();
+      }
+      return node_t::balance(point->left, min->entry, erase_min(point->right));
+    }
+
+    static pointer erase_min(pointer const& point) {
+      if (point->left == nullptr) {
+        return point->right;
+      }
+      return node_t::balance(erase_min(point->left), point->entry, point->right);
+    }
+
+    pointer root;
+    [[no_unique_address]] Compare compare;
+  };
+}
+
+// bimap whose versions are immutable: insert and erase build O(log n) new
+// nodes and share the rest with the previous version, so copying the map
+// or taking a snapshot() is O(1) and a snapshot stays readable, unchanged,
+// while the map it came from is modified. Both sides share one entry per
+// pair. Iterators refer to the version they came from and are invalidated
+// when the map they belong to is modified or destroyed; flip() looks the
+// other key up, so it is O(log n).
+template <typename Left, typename Right,
+          typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>>
+struct persistent_bimap {
+private:
+  using left_t = Left;
+  using right_t = Right;
+  using entry_t = std::pair<Left, Right>;
+  using node_t = bimap_impl::persistent_node<entry_t>;
+  using left_tree_t = bimap_impl::persistent_tree<entry_t, CompareLeft, bimap_impl::left_tag>;
+  using right_tree_t = bimap_impl::persistent_tree<entry_t, CompareRight, bimap_impl::right_tag>;
+
+  template <typename Tag>
+  struct base_iterator;
+
+public:
+  using left_iterator = base_iterator<bimap_impl::left_tag>;
+  using right_iterator = base_iterator<bimap_impl::right_tag>;
+  using change_kind = bimap_impl::change_kind;
+
+  persistent_bimap(CompareLeft compare_left = CompareLeft(),
+                   CompareRight compare_right = CompareRight())
+      : left_tree(std::move(compare_left)),
+        right_tree(std::move(compare_right)) {}
+
+  persistent_bimap snapshot() const {
+    return *this;
+  }
+
+
+  left_iterator insert(left_t const& left, right_t const& right) {
+    return insert_entry(std::make_shared<entry_t const>(left, right));
+  }
+
+  left_iterator insert(left_t const& left, right_t&& right) {
+    return insert_entry(std::make_shared<entry_t const>(left, std::move(right)));
+  }
+
+  left_iterator insert(left_t&& left, right_t const& right) {
+    return insert_entry(std::make_shared<entry_t const>(std::move(left), right));
+  }
+
+  left_iterator insert(left_t&& left, right_t&& right) {
+    return insert_entry(std::make_shared<entry_t const>(std::move(left), std::move(right)));
+  }
+
+
+  bool erase_left(left_t const& left) {
+    return erase_left<left_t>(left);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+  bool erase_left(Key const& left) {
+    node_t const* node = left_tree.find(left);
+    if (node == nullptr) {
+      return false;
+    }
+    erase_entry(node->entry);
+    return true;
+  }
+
+  bool erase_right(right_t const& right) {
+    return erase_right<right_t>(right);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+  bool erase_right(Key const& right) {
+    node_t const* node = right_tree.find(right);
+    if (node == nullptr) {
+      return false;
+    }
+    erase_entry(node->entry);
+    return true;
+  }
+
+
+  left_iterator find_left(left_t const& left) const {
+    return find_left<left_t>(left);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+  left_iterator find_left(Key const& left) const {
+    left_iterator it = lower_bound_left(left);
+    return it == end_left() || left_tree.get_comparator()(left, *it) ? end_left() : it;
+  }
+
+  right_iterator find_right(right_t const& right) const {
+    return find_right<right_t>(right);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+  right_iterator find_right(Key const& right) const {
+    right_iterator it = lower_bound_right(right);
+    return it == end_right() || right_tree.get_comparator()(right, *it) ? end_right() : it;
+  }
+
+
+  right_t const& at_left(left_t const& key) const {
+    return at_left<left_t>(key);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+  right_t const& at_left(Key const& key) const {
+    node_t const* node = left_tree.find(key);
+    if (node == nullptr) {
+      throw std::out_of_range("no entry exists");
+    }
+    return node->entry->second;
+  }
+
+  left_t const& at_right(right_t const& key) const {
+    return at_right<right_t>(key);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+  left_t const& at_right(Key const& key) const {
+    node_t const* node = right_tree.find(key);
+    if (node == nullptr) {
+      throw std::out_of_range("no entry exists");
+    }
+    return node->entry->first;
+  }
+
+
+  left_iterator lower_bound_left(left_t const& left) const {
+    return lower_bound_left<left_t>(left);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+  left_iterator lower_bound_left(Key const& left) const {
+    left_iterator it(this);
+    left_tree.bound(left, false, it.path);
+    return it;
+  }
+
+  left_iterator upper_bound_left(left_t const& left) const {
+    return upper_bound_left<left_t>(left);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, left_t, CompareLeft>>>
+  left_iterator upper_bound_left(Key const& left) const {
+    left_iterator it(this);
+    left_tree.bound(left, true, it.path);
+    return it;
+  }
+
+
+  right_iterator lower_bound_right(right_t const& right) const {
+    return lower_bound_right<right_t>(right);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+  right_iterator lower_bound_right(Key const& right) const {
+    right_iterator it(this);
+    right_tree.bound(right, false, it.path);
+    return it;
+  }
+
+  right_iterator upper_bound_right(right_t const& right) const {
+    return upper_bound_right<right_t>(right);
+  }
+
+  template <typename Key, typename = std::enable_if_t<bimap_impl::is_key_v<Key, right_t, CompareRight>>>
+  right_iterator upper_bound_right(Key const& right) const {
+    right_iterator it(this);
+    right_tree.bound(right, true, it.path);
+    return it;
+  }
+
+
+  left_iterator begin_left() const {
+    return left_iterator(this).to_min(left_tree.get_root());
+  }
+
+  left_iterator end_left() const {
+    return left_iterator(this);
+  }
+
+
+  right_iterator begin_right() const {
+    return right_iterator(this).to_min(right_tree.get_root());
+  }
+
+  right_iterator end_right() const {
+    return right_iterator(this);
+  }
+
+
+  void clear() noexcept {
+    left_tree.clear();
+    right_tree.clear();
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  size_t size() const {
+    return left_tree.size();
+  }
+
+
+  friend bool operator==(persistent_bimap const& a, persistent_bimap const& b) {
+    return a.compare_equal(b);
+  }
+
+  friend bool operator!=(persistent_bimap const& a, persistent_bimap const& b) {
+    return !a.compare_equal(b);
+  }
+
+  // Calls visit(kind, left, right) like diff of bimap. Both left trees are
+  // walked in lockstep, but a subtree that a and b share is skipped whole,
+  // so diffing versions of one map costs O(log n) per change, not O(n).
+  template <typename Visit>
+  friend void diff(persistent_bimap const& a, persistent_bimap const& b, Visit&& visit) {
+    a.diff_with(b, visit);
+  }
+
+  void swap(persistent_bimap& other) noexcept {
+    left_tree.swap(other.left_tree);
+    right_tree.swap(other.right_tree);
+  }
+
+private:
+  bool compare_equal(persistent_bimap const& other) const {
+    if (size() != other.size()) {
+      return false;
+    }
+    auto const& compare_left = left_tree.get_comparator();
+    auto const& compare_right = right_tree.get_comparator();
+    for (auto it = begin_left(), other_it = other.begin_left(); it != end_left(); ++it, ++other_it) {
+      if (compare_left(*it, *other_it) || compare_left(*other_it, *it) ||
+          compare_right(it.entry().second, other_it.entry().second) ||
+          compare_right(other_it.entry().second, it.entry().second)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // A subtree still to walk, or only the entry of its root once its
+  // children have been pushed around it.
+  struct diff_item {
+    node_t const* node;
+    bool entry_only;
+  };
+
+  static void expand(std::vector<diff_item>& stack) {
+    node_t const* node = stack.back().node;
+    stack.pop_back();
+    if (node->right != nullptr) {
+      stack.push_back({node->right.get(), false});
+    }
+    stack.push_back({node, true});
+    if (node->left != nullptr) {
+      stack.push_back({node->left.get(), false});
+    }
+  }
+
+  template <typename Visit>
+  static void drain(std::vector<diff_item>& stack, change_kind kind, Visit& visit) {
+    while (!stack.empty()) {
+      if (stack.back().entry_only) {
+        entry_t const& entry = *stack.back().node->entry;
+        stack.pop_back();
+        visit(kind, entry.first, entry.second);
+      } else {
+        expand(stack);
+      }
+    }
+  }
+
+  // Both trees are streams of subtrees that are split only when they differ:
+  // two equal subtrees on top of both stacks hold the same entries at the
+  // same place in left order. Otherwise the taller one is split, so shared
+  // subtrees of other shapes around them get to meet on top.
+  template <typename Visit>
+  void diff_with(persistent_bimap const& other, Visit& visit) const {
+    auto const& compare_left = left_tree.get_comparator();
+    auto const& compare_right = right_tree.get_comparator();
+    std::vector<diff_item> stack, other_stack;
+    if (left_tree.get_root() != nullptr) {
+      stack.push_back({left_tree.get_root(), false});
+    }
+    if (other.left_tree.get_root() != nullptr) {
+      other_stack.push_back({other.left_tree.get_root(), false});
+    }
+    while (!stack.empty() && !other_stack.empty()) {
+      diff_item item = stack.back();
+      diff_item other_item = other_stack.back();
+      if (!item.entry_only && !other_item.entry_only) {
+        if (item.node == other_item.node) {
+          stack.pop_back();
+          other_stack.pop_back();
+        } else if (item.node->height >= other_item.node->height) {
+          expand(stack);
+        } else {
+          expand(other_stack);
+        }
+        continue;
+      }
+      if (!item.entry_only) {
+        expand(stack);
+        continue;
+      }
+      if (!other_item.entry_only) {
+        expand(other_stack);
+        continue;
+      }
+      entry_t const& entry = *item.node->entry;
+      entry_t const& other_entry = *other_item.node->entry;
+      if (compare_left(entry.first, other_entry.first)) {
+        stack.pop_back();
+        visit(change_kind::removed, entry.first, entry.second);
+      } else if (compare_left(other_entry.first, entry.first)) {
+        other_stack.pop_back();
+        visit(change_kind::inserted, other_entry.first, other_entry.second);
+      } else {
+        stack.pop_back();
+        other_stack.pop_back();
+        if (item.node->entry != other_item.node->entry &&
+            (compare_right(entry.second, other_entry.second) || compare_right(other_entry.second, entry.second))) {
+          visit(change_kind::remapped, other_entry.first, other_entry.second);
+        }
+      }
+    }
+    drain(stack, change_kind::removed, visit);
+    drain(other_stack, change_kind::inserted, visit);
+  }
+
+  template <typename Tag>
+  auto const& get_tree() const noexcept {
+    if constexpr (std::is_same_v<Tag, bimap_impl::left_tag>) {
+      return left_tree;
+    } else {
+      return right_tree;
+    }
+  }
+
+  left_iterator insert_entry(std::shared_ptr<entry_t const> entry) {
+    if (left_tree.find(entry->first) != nullptr || right_tree.find(entry->second) != nullptr) {
+      return end_left();
+    }
+    left_tree_t left_result = left_tree;
+    left_result.insert(entry);
+    right_tree.insert(entry);
+    left_tree.swap(left_result);
+    return find_left(entry->first);
+  }
+
+  void erase_entry(std::shared_ptr<entry_t const> entry) {
+    left_tree_t left_result = left_tree;
+    left_result.erase(entry->first);
+    right_tree.erase(entry->second);
+    left_tree.swap(left_result);
+  }
+
+  template <typename Tag>
+  struct base_iterator {
+  private:
+    using flip_tag = std::conditional_t<std::is_same_v<Tag, bimap_impl::left_tag>,
+                                        bimap_impl::right_tag, bimap_impl::left_tag>;
+    using value_t = std::conditional_t<std::is_same_v<Tag, bimap_impl::left_tag>, Left, Right>;
+
+  public:
+    base_iterator() = default;
+
+    value_t const& operator*() const {
+      if constexpr (std::is_same_v<Tag, bimap_impl::left_tag>) {
+        return entry().first;
+      } else {
+        return entry().second;
+      }
+    }
+
+    value_t const* operator->() const {
+      return &**this;
+    }
+
+
+    base_iterator& operator++() {
+      node_t const* point = path.back();
+      if (point->right != nullptr) {
+        to_min(point->right.get());
+        return *this;
+      }
+      path.pop_back();
+      while (!path.empty() && path.back()->right.get() == point) {
+        point = path.back();
+        path.pop_back();
+      }
+      return *this;
+    }
+
+    base_iterator operator++(int) {
+      base_iterator old(*this);
+      ++(*this);
+      return old;
+    }
+
+
+    base_iterator& operator--() {
+      if (path.empty()) {
+        return to_max(owner->template get_tree<Tag>().get_root());
+      }
+      node_t const* point = path.back();
+      if (point->left != nullptr) {
+        return to_max(point->left.get());
+      }
+      path.pop_back();
+      while (!path.empty() && path.back()->left.get() == point) {
+        point = path.back();
+        path.pop_back();
+      }
+      return *this;
+    }
+
+    base_iterator operator--(int) {
+      base_iterator old(*this);
+      --(*this);
+      return old;
+    }
+
+
+    base_iterator<flip_tag> flip() const {
+      base_iterator<flip_tag> result(owner);
+      if (!path.empty()) {
+        if constexpr (std::is_same_v<Tag, bimap_impl::left_tag>) {
+          owner->right_tree.bound(entry().second, false, result.path);
+        } else {
+          owner->left_tree.bound(entry().first, false, result.path);
+        }
+      }
+      return result;
+    }
+
+
+    friend bool operator==(base_iterator const& lhs, base_iterator const& rhs) {
+      if (lhs.path.empty() || rhs.path.empty()) {
+        return lhs.path.empty() && rhs.path.empty();
+      }
+      return lhs.path.back() == rhs.path.back();
+    }
+
+    friend bool operator!=(base_iterator const& lhs, base_iterator const& rhs) {
+      return !(lhs == rhs);
+    }
+
+
+    template <typename Left_, typename Right_, typename CompareLeft_, typename CompareRight_>
+    friend struct persistent_bimap;
+
+    template <typename Tag_>
+    friend struct base_iterator;
+
+  private:
+    explicit base_iterator(persistent_bimap const* owner) : owner(owner) {}
+
+    entry_t const& entry() const {
+      return *path.back()->entry;
+    }
+
+    base_iterator& to_min(node_t const* point) {
+      for (; point != nullptr; point = point->left.get()) {
+        path.push_back(point);
+      }
+      return *this;
+    }
+
+    base_iterator& to_max(node_t const* point) {
+      for (; point != nullptr; point = point->right.get()) {
+        path.push_back(point);
+      }
+      return *this;
+    }
+
+    persistent_bimap const* owner{nullptr};
+    std::vector<node_t const*> path;
+  };
+
+  left_tree_t left_tree;
+  right_tree_t right_tree;
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+
+namespace bimap_impl {
+  // Hands out blocks of one size from big chunks, which are only returned
+  // to the system when the pool dies. The block size is fixed by the first
+  // allocation, requests of any other size fall back to operator new.
+  struct node_pool {
+    explicit node_pool(size_t chunk_blocks) noexcept;
+
+    node_pool(node_pool const&) = delete;
+    node_pool& operator=(node_pool const&) = delete;
+
+    ~node_pool();
+
+    void* allocate(size_t size, size_t align);
+
+    void deallocate(void* block, size_t size, size_t align) noexcept;
+
+  private:
+    struct free_block {
+      free_block* next;
+    };
+
+    struct chunk_header {
+      chunk_header* next;
+    };
+
+    bool is_pooled(size_t size, size_t align) const noexcept;
+
+    void add_chunk();
+
+    size_t chunk_blocks;
+    size_t object_size{0};
+    size_t object_align{0};
+    size_t block_size{0};
+    size_t block_align{0};
+    free_block* free_list{nullptr};
+    chunk_header* chunks{nullptr};
+    char* current{nullptr};
+    char* current_end{nullptr};
+  };
+}
+
+// Allocator for node based containers: single objects are carved out of
+// a shared node_pool, so nodes are allocated without calling malloc and
+// lie next to each other. Copies and rebinds share the pool. Not thread-safe.
+template <typename T, size_t ChunkBlocks = 4096>
+struct pool_allocator {
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  template <typename U>
+  struct rebind {
+    using other = pool_allocator<U, ChunkBlocks>;
+  };
+
+  pool_allocator()
+      : pool(std::make_shared<bimap_impl::node_pool>(ChunkBlocks)) {}
+
+  template <typename U>
+  pool_allocator(pool_allocator<U, ChunkBlocks> const& other) noexcept
+      : pool(other.pool) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(pool->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T* p, size_t n) noexcept {
+    pool->deallocate(p, n * sizeof(T), alignof(T));
+  }
+
+  template <typename U>
+  friend bool operator==(pool_allocator const& lhs, pool_allocator<U, ChunkBlocks> const& rhs) noexcept {
+    return lhs.pool == rhs.pool;
+  }
+
+  template <typename U>
+  friend bool operator!=(pool_allocator const& lhs, pool_allocator<U, ChunkBlocks> const& rhs) noexcept {
+    return lhs.pool != rhs.pool;
+  }
+
+  template <typename U, size_t ChunkBlocks_>
+  friend struct pool_allocator;
+
+private:
+  std::shared_ptr<bimap_impl::node_pool> pool;
+};
@@ -0,0 +1,28 @@
+#include "concurrent-bimap.h"
+
+namespace bimap_impl {
+
+void read_indicator::arrive() noexcept {
+  slots[this_slot()].readers.fetch_add(1);
+}
+
+void read_indicator::depart() noexcept {
+  slots[this_slot()].readers.fetch_sub(1);
+}
+
+bool read_indicator::is_empty() const noexcept {
+  for (slot const& s : slots) {
+    if (s.readers.load() != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t read_indicator::this_slot() noexcept {
+  static std::atomic<size_t> next_slot{0};
+  thread_local size_t slot = next_slot.fetch_add(1) % slot_count;
+  return slot;
+}
+
+}
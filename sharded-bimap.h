@@ -0,0 +1,199 @@
+#pragma once
+
+#include "bimap.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
+
+// bimap split by hash into shards with a lock each, so operations on keys of
+// different shards run in parallel. A pair lives in the shard of its left
+// key and in the shard of its right key, which is what keeps both sides
+// unique over the whole map: the shard of a key is the only place where that
+// key can be. Inserting or erasing a pair locks both of its shards, always in
+// the order of their numbers.
+template <typename Left, typename Right,
+          typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>,
+          typename HashLeft = std::hash<Left>,
+          typename HashRight = std::hash<Right>>
+struct sharded_bimap {
+private:
+  using left_t = Left;
+  using right_t = Right;
+  using bimap_t = bimap<Left, Right, CompareLeft, CompareRight>;
+
+  struct alignas(64) shard {
+    mutable std::shared_mutex mutex;
+    bimap_t map;
+  };
+
+public:
+  explicit sharded_bimap(size_t shard_count = 4 * std::max(std::thread::hardware_concurrency(), 1u),
+                         CompareLeft compare_left = CompareLeft(),
+                         CompareRight compare_right = CompareRight(),
+                         HashLeft hash_left = HashLeft(),
+                         HashRight hash_right = HashRight())
+      : shards(new shard[std::max<size_t>(shard_count, 1)]),
+        shard_count(std::max<size_t>(shard_count, 1)),
+        hash_left(std::move(hash_left)),
+        hash_right(std::move(hash_right)) {
+    for (size_t i = 0; i < this->shard_count; ++i) {
+      shards[i].map = bimap_t(compare_left, compare_right);
+    }
+  }
+
+  sharded_bimap(sharded_bimap const&) = delete;
+  sharded_bimap& operator=(sharded_bimap const&) = delete;
+
+
+  bool insert(left_t const& left, right_t const& right) {
+    size_t left_shard = shard_of_left(left);
+    size_t right_shard = shard_of_right(right);
+    auto locks = lock_both(left_shard, right_shard);
+    bimap_t& left_map = shards[left_shard].map;
+    bimap_t& right_map = shards[right_shard].map;
+    if (left_map.find_left(left) != left_map.end_left() ||
+        right_map.find_right(right) != right_map.end_right()) {
+      return false;
+    }
+    left_map.insert(left, right);
+    if (left_shard != right_shard) {
+      try {
+        right_map.insert(left, right);
+      } catch (...) {
+        left_map.erase_left(left);
+        throw;
+      }
+    }
+    ++pair_count;
+    return true;
+  }
+
+  bool erase_left(left_t const& left) {
+    size_t left_shard = shard_of_left(left);
+    while (true) {
+      std::optional<right_t> right = find_left(left);
+      if (!right) {
+        return false;
+      }
+      size_t right_shard = shard_of_right(*right);
+      auto locks = lock_both(left_shard, right_shard);
+      if (erase_locked(left, *right, left_shard, right_shard)) {
+        return true;
+      }
+    }
+  }
+
+  bool erase_right(right_t const& right) {
+    size_t right_shard = shard_of_right(right);
+    while (true) {
+      std::optional<left_t> left = find_right(right);
+      if (!left) {
+        return false;
+      }
+      size_t left_shard = shard_of_left(*left);
+      auto locks = lock_both(left_shard, right_shard);
+      if (erase_locked(*left, right, left_shard, right_shard)) {
+        return true;
+      }
+    }
+  }
+
+
+  std::optional<right_t> find_left(left_t const& left) const {
+    shard const& s = shards[shard_of_left(left)];
+    std::shared_lock<std::shared_mutex> lock(s.mutex);
+    auto it = s.map.find_left(left);
+    if (it == s.map.end_left()) {
+      return std::nullopt;
+    }
+    return *it.flip();
+  }
+
+  std::optional<left_t> find_right(right_t const& right) const {
+    shard const& s = shards[shard_of_right(right)];
+    std::shared_lock<std::shared_mutex> lock(s.mutex);
+    auto it = s.map.find_right(right);
+    if (it == s.map.end_right()) {
+      return std::nullopt;
+    }
+    return *it.flip();
+  }
+
+
+  right_t at_left(left_t const& key) const {
+    std::optional<right_t> right = find_left(key);
+    if (!right) {
+      throw std::out_of_range("no entry exists");
+    }
+    return *std::move(right);
+  }
+
+  left_t at_right(right_t const& key) const {
+    std::optional<left_t> left = find_right(key);
+    if (!left) {
+      throw std::out_of_range("no entry exists");
+    }
+    return *std::move(left);
+  }
+
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  size_t size() const {
+    return pair_count.load();
+  }
+
+private:
+  // Spreads the bits of std::hash, which is the identity for integers.
+  static size_t mix(size_t hash) noexcept {
+    return static_cast<size_t>((static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ull) >> 32);
+  }
+
+  size_t shard_of_left(left_t const& left) const {
+    return mix(hash_left(left)) % shard_count;
+  }
+
+  size_t shard_of_right(right_t const& right) const {
+    return mix(hash_right(right)) % shard_count;
+  }
+
+  std::pair<std::unique_lock<std::shared_mutex>, std::unique_lock<std::shared_mutex>>
+  lock_both(size_t first, size_t second) {
+    if (first > second) {
+      std::swap(first, second);
+    }
+    std::unique_lock<std::shared_mutex> first_lock(shards[first].mutex);
+    if (first == second) {
+      return {std::move(first_lock), std::unique_lock<std::shared_mutex>()};
+    }
+    return {std::move(first_lock), std::unique_lock<std::shared_mutex>(shards[second].mutex)};
+  }
+
+  // The pair was looked up without these locks, so it may have changed since.
+  bool erase_locked(left_t const& left, right_t const& right, size_t left_shard, size_t right_shard) {
+    bimap_t& left_map = shards[left_shard].map;
+    auto it = left_map.find_left(left);
+    if (it == left_map.end_left() || left_map.find_right(right).flip() != it) {
+      return false;
+    }
+    left_map.erase_left(it);
+    if (left_shard != right_shard) {
+      shards[right_shard].map.erase_right(right);
+    }
+    --pair_count;
+    return true;
+  }
+
+  std::unique_ptr<shard[]> shards;
+  size_t shard_count;
+  [[no_unique_address]] HashLeft hash_left;
+  [[no_unique_address]] HashRight hash_right;
+  std::atomic<size_t> pair_count{0};
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+
+namespace bimap_impl {
+  // Searches shared by the bimaps that keep each side as a sorted array and
+  // every pair as a position on the other side, such as flat_bimap and
+  // mapped_bimap. Derived gives the key at a position of a side with
+  // key_at<Tag>, the position of its pair with flip_at<Tag> and the
+  // comparator of the side with get_compare<Tag>.
+  template <typename Derived>
+  struct sorted_array_sides {
+  protected:
+    template <typename Tag, typename Key>
+    size_t lower_index(Key const& key) const {
+      auto const& compare = derived().template get_compare<Tag>();
+      return partition_point<Tag>([&](size_t index) {
+        return compare(derived().template key_at<Tag>(index), key);
+      });
+    }
+
+    template <typename Tag, typename Key>
+    size_t upper_index(Key const& key) const {
+      auto const& compare = derived().template get_compare<Tag>();
+      return partition_point<Tag>([&](size_t index) {
+        return !compare(key, derived().template key_at<Tag>(index));
+      });
+    }
+
+    template <typename Tag, typename Key>
+    size_t find_index(Key const& key) const {
+      size_t index = lower_index<Tag>(key);
+      if (index != derived().size() &&
+          derived().template get_compare<Tag>()(key, derived().template key_at<Tag>(index))) {
+        return derived().size();
+      }
+      return index;
+    }
+
+  private:
+    Derived const& derived() const noexcept {
+      return static_cast<Derived const&>(*this);
+    }
+
+    // First position of a side for which before is false.
+    template <typename Tag, typename Before>
+    size_t partition_point(Before const& before) const {
+      size_t first = 0;
+      size_t count = derived().size();
+      while (count > 0) {
+        size_t half = count / 2;
+        if (before(first + half)) {
+          first += half + 1;
+          count -= half + 1;
+        } else {
+          count = half;
+        }
+      }
+      return first;
+    }
+  };
+
+
+  // Random access position on one side of a sorted_array_sides bimap.
+  template <typename Owner, typename Value, typename Tag, typename FlipValue, typename FlipTag>
+  struct array_iterator {
+  private:
+    using value_t = Value;
+    using flip_iterator = array_iterator<Owner, FlipValue, FlipTag, Value, Tag>;
+
+  public:
+    array_iterator() = default;
+
+    value_t const& operator*() const {
+      return owner->template key_at<Tag>(index);
+    }
+
+    value_t const* operator->() const {
+      return &owner->template key_at<Tag>(index);
+    }
+
+
+    array_iterator& operator++() {
+      ++index;
+      return *this;
+    }
+
+    array_iterator operator++(int) {
+      array_iterator old(*this);
+      ++(*this);
+      return old;
+    }
+
+
+    array_iterator& operator--() {
+      --index;
+      return *this;
+    }
+
+    array_iterator operator--(int) {
+      array_iterator old(*this);
+      --(*this);
+      return old;
+    }
+
+
+    flip_iterator flip() const {
+      if (index == owner->size()) {
+        return flip_iterator(owner, index);
+      }
+      return flip_iterator(owner, owner->template flip_at<Tag>(index));
+    }
+
+
+    friend bool operator==(array_iterator const& lhs, array_iterator const& rhs) {
+      return lhs.owner == rhs.owner && lhs.index == rhs.index;
+    }
+
+    friend bool operator!=(array_iterator const& lhs, array_iterator const& rhs) {
+      return !(lhs == rhs);
+    }
+
+
+    friend Owner;
+
+    template <typename Owner_, typename Value_, typename Tag_, typename FlipValue_, typename FlipTag_>
+    friend struct array_iterator;
+
+  private:
+    array_iterator(Owner const* owner, size_t index) noexcept
+        : owner(owner), index(index) {}
+
+    Owner const* owner{nullptr};
+    size_t index{0};
+  };
+}
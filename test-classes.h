@@ -37,6 +37,16 @@ private:
   distance_type type;
 };
 
+struct counting_less {
+  static inline size_t calls = 0;
+
+  template <typename T>
+  bool operator()(T const &a, T const &b) const {
+    ++calls;
+    return a < b;
+  }
+};
+
 struct non_default_constructible {
   non_default_constructible() = delete;
   explicit non_default_constructible(int b) : a(b) {}
@@ -51,3 +61,35 @@ private:
   int a;
 };
 
+
+template <typename T>
+struct counting_allocator {
+  using value_type = T;
+
+  explicit counting_allocator(size_t* allocated) : allocated(allocated) {}
+
+  template <typename U>
+  counting_allocator(counting_allocator<U> const& other) : allocated(other.allocated) {}
+
+  T* allocate(size_t n) {
+    *allocated += n;
+    return std::allocator<T>().allocate(n);
+  }
+
+  void deallocate(T* p, size_t n) {
+    *allocated -= n;
+    std::allocator<T>().deallocate(p, n);
+  }
+
+  template <typename U>
+  friend bool operator==(counting_allocator const& c, counting_allocator<U> const& b) {
+    return c.allocated == b.allocated;
+  }
+
+  template <typename U>
+  friend bool operator!=(counting_allocator const& c, counting_allocator<U> const& b) {
+    return c.allocated != b.allocated;
+  }
+
+  size_t* allocated;
+};
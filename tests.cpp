@@ -1,7 +1,19 @@
+#include <chrono>
 #include <random>
+#include <shared_mutex>
+#include <sstream>
+#include <thread>
 
 #include "bimap.h"
+#include "concurrent-bimap.h"
+#include "flat-bimap.h"
+#include "indexed-bimap.h"
+#include "mapped-bimap.h"
+#include "persistent-bimap.h"
+#include "pool-allocator.h"
+#include "sharded-bimap.h"
 #include "test-classes.h"
+#include "unordered-bimap.h"
 #include "gtest/gtest.h"
 
 TEST(bimap, leak_check) {
@@ -75,6 +87,108 @@ TEST(bimap, insert) {
   EXPECT_EQ(b.at_left(10), 4);
 }
 
+TEST(bimap, insert_hint) {
+  bimap<int, int> b;
+  auto it = b.insert(b.end_left(), 5, 50);
+  it = b.insert(it, 7, 70);
+  EXPECT_EQ(*it, 7);
+  b.insert(it, 6, 60);
+  b.insert(b.begin_left(), 1, 10);
+  b.insert(b.end_left(), 3, 30);
+  b.insert(b.find_left(6), 0, 0);
+  b.insert(b.find_right(10), 2, 20);
+  b.insert(b.end_right(), 9, 90);
+  EXPECT_EQ(b.insert(b.find_left(3), 3, 33), b.end_left());
+  EXPECT_EQ(b.insert(b.end_right(), 4, 90), b.end_left());
+
+  std::vector<int> expected = {0, 1, 2, 3, 5, 6, 7, 9};
+  EXPECT_EQ(b.size(), expected.size());
+  auto lit = b.begin_left();
+  for (int x : expected) {
+    EXPECT_EQ(*lit, x);
+    EXPECT_EQ(*lit.flip(), x * 10);
+    ++lit;
+  }
+}
+
+TEST(bimap, insert_range) {
+  std::vector<std::pair<int, int>> pairs = {
+      {5, 50}, {1, 10}, {5, 51}, {2, 10}, {3, 30}, {2, 20}, {4, 40}, {0, 30}};
+  bimap<int, int> b(pairs.begin(), pairs.end());
+
+  std::vector<std::pair<int, int>> expected = {{1, 10}, {2, 20}, {3, 30}, {4, 40}, {5, 50}};
+  EXPECT_EQ(b.size(), expected.size());
+  auto lit = b.begin_left();
+  for (auto const &p : expected) {
+    EXPECT_EQ(*lit, p.first);
+    EXPECT_EQ(*lit.flip(), p.second);
+    ++lit;
+  }
+  EXPECT_EQ(*b.find_right(30).flip(), 3);
+
+  std::vector<std::tuple<int, int>> more = {{6, 10}, {7, 70}, {3, 31}, {-1, -10}};
+  b.insert(more.begin(), more.end());
+  EXPECT_EQ(b.size(), 7);
+  EXPECT_EQ(b.at_left(7), 70);
+  EXPECT_EQ(b.at_left(-1), -10);
+  EXPECT_EQ(b.at_left(3), 30);
+  EXPECT_EQ(b.find_left(6), b.end_left());
+
+  bimap<int, int> empty(pairs.end(), pairs.end());
+  EXPECT_TRUE(empty.empty());
+}
+
+struct picky_less {
+  bool operator()(int a, int b) const {
+    if (a == 13 || b == 13) {
+      throw std::runtime_error("unlucky");
+    }
+    return a < b;
+  }
+};
+
+TEST(bimap, insert_range_exception) {
+  std::vector<std::pair<int, int>> unlucky = {{1, 10}, {13, 20}, {3, 30}};
+  bimap<int, int, picky_less> b;
+  EXPECT_THROW(b.insert(unlucky.begin(), unlucky.end()), std::runtime_error);
+  EXPECT_TRUE(b.empty());
+
+  for (int i = 100; i < 1100; i++) {
+    b.insert(i, i);
+  }
+  EXPECT_THROW(b.insert(unlucky.begin(), unlucky.end()), std::runtime_error);
+  EXPECT_EQ(b.size(), 1000);
+  EXPECT_EQ(b.find_left(1), b.end_left());
+  EXPECT_EQ(b.find_right(10), b.end_right());
+  EXPECT_EQ(*b.begin_left(), 100);
+  EXPECT_EQ(*b.begin_right(), 100);
+}
+
+TEST(bimap, insert_stream) {
+  std::istringstream in("5 50 1 10 5 51 2 10 3 30 2 20 4 40 0 30 x 1");
+  bimap<int, int> b;
+  b.insert_stream(in, 3);
+  EXPECT_TRUE(in.fail());
+  EXPECT_FALSE(in.eof());
+  std::vector<std::pair<int, int>> pairs = {
+      {5, 50}, {1, 10}, {5, 51}, {2, 10}, {3, 30}, {2, 20}, {4, 40}, {0, 30}};
+  EXPECT_EQ(b, (bimap<int, int>(pairs.begin(), pairs.end())));
+
+  std::vector<std::pair<int, int>> more = {{6, 10}, {7, 70}, {8, 80}, {9, 70}, {-1, -10}};
+  b.insert_stream(more.begin(), more.end(), 2);
+  EXPECT_EQ(b.size(), 8);
+  EXPECT_EQ(b.at_left(7), 70);
+  EXPECT_EQ(b.at_left(8), 80);
+  EXPECT_EQ(b.at_left(-1), -10);
+  EXPECT_EQ(b.find_left(6), b.end_left());
+  EXPECT_EQ(b.find_left(9), b.end_left());
+
+  std::istringstream empty("");
+  b.insert_stream(empty);
+  EXPECT_TRUE(empty.eof());
+  EXPECT_EQ(b.size(), 8);
+}
+
 TEST(bimap, insert_move) {
   bimap<int, test_object> b;
   test_object x(3), x2(3);
@@ -100,6 +214,62 @@ TEST(bimap, insert_move) {
   EXPECT_EQ(it.flip()->a, 2);
 }
 
+TEST(bimap, emplace) {
+  bimap<std::string, std::vector<int>> b;
+  auto it = b.emplace(std::piecewise_construct, std::forward_as_tuple(3, 'a'),
+                      std::forward_as_tuple(2, 7));
+  EXPECT_EQ(*it, "aaa");
+  EXPECT_EQ(*it.flip(), std::vector<int>({7, 7}));
+
+  it = b.emplace("bb", std::vector<int>{1});
+  EXPECT_EQ(b.at_left("bb"), std::vector<int>({1}));
+  EXPECT_EQ(b.emplace("aaa", std::vector<int>{2}), b.end_left());
+  EXPECT_EQ(b.emplace("c", std::vector<int>{7, 7}), b.end_left());
+  EXPECT_EQ(b.size(), 2);
+}
+
+TEST(bimap, try_emplace) {
+  using allocator_t = counting_allocator<std::pair<std::string, std::string>>;
+  size_t allocated = 0;
+  bimap<std::string, std::string, std::less<>, std::less<>, allocator_t> b((allocator_t(&allocated)));
+
+  auto it = b.try_emplace("left", std::string_view("right"));
+  EXPECT_EQ(*it, "left");
+  EXPECT_EQ(*it.flip(), "right");
+  EXPECT_EQ(allocated, 1);
+
+  EXPECT_EQ(b.try_emplace("left", "other"), b.end_left());
+  EXPECT_EQ(b.try_emplace("other", "right"), b.end_left());
+  EXPECT_EQ(allocated, 1);
+
+  std::string key = "key";
+  b.try_emplace(std::move(key), std::string("value"));
+  EXPECT_EQ(b.at_right(std::string("value")), "key");
+  EXPECT_EQ(b.size(), 2);
+}
+
+TEST(bimap, transparent_lookup) {
+  bimap<std::string, std::string, std::less<>, std::less<>> b;
+  b.insert("a", "x");
+  b.insert("c", "z");
+
+  EXPECT_EQ(*b.find_left("a").flip(), "x");
+  EXPECT_EQ(b.find_right(std::string_view("y")), b.end_right());
+  EXPECT_EQ(b.at_left("c"), "z");
+  EXPECT_EQ(b.at_right(std::string_view("x")), "a");
+  EXPECT_THROW(b.at_left("b"), std::out_of_range);
+
+  EXPECT_EQ(*b.lower_bound_left("b"), "c");
+  EXPECT_EQ(*b.upper_bound_left("a"), "c");
+  EXPECT_EQ(*b.lower_bound_right(std::string_view("x")), "x");
+  EXPECT_EQ(b.upper_bound_right("z"), b.end_right());
+
+  EXPECT_FALSE(b.erase_left("b"));
+  EXPECT_TRUE(b.erase_right("z"));
+  EXPECT_TRUE(b.erase_left(std::string_view("a")));
+  EXPECT_TRUE(b.empty());
+}
+
 TEST(bimap, at) {
   bimap<int, int> b;
   b.insert(4, 3);
@@ -243,6 +413,136 @@ TEST(bimap, erase_range) {
   EXPECT_TRUE(b.empty());
 }
 
+TEST(bimap, clear) {
+  bimap<int, int> b;
+  b.clear();
+  EXPECT_TRUE(b.empty());
+
+  for (int i = 0; i < 100; i++) {
+    b.insert(i, -i);
+  }
+  b.clear();
+  EXPECT_TRUE(b.empty());
+  EXPECT_EQ(b.begin_left(), b.end_left());
+  EXPECT_EQ(b.begin_right(), b.end_right());
+  EXPECT_EQ(b.find_left(5), b.end_left());
+  EXPECT_EQ(b.end_left().flip(), b.end_right());
+
+  b.insert(5, 6);
+  EXPECT_EQ(b.size(), 1);
+  EXPECT_EQ(b.at_right(6), 5);
+}
+
+TEST(bimap, allocator) {
+  using allocator_t = counting_allocator<std::pair<int, int>>;
+  size_t allocated = 0;
+  {
+    bimap<int, int, std::less<>, std::less<>, allocator_t> b((allocator_t(&allocated)));
+    EXPECT_EQ(allocated, 0);
+    for (int i = 0; i < 10; i++) {
+      b.insert(i, i);
+    }
+    EXPECT_EQ(allocated, 10);
+    b.insert(1, 100);
+    EXPECT_EQ(allocated, 10);
+    b.erase_left(3);
+    EXPECT_EQ(allocated, 9);
+
+    auto copy = b;
+    EXPECT_EQ(allocated, 18);
+    EXPECT_EQ(copy.get_allocator(), b.get_allocator());
+    copy.clear();
+    EXPECT_EQ(allocated, 9);
+
+    auto moved = std::move(b);
+    EXPECT_EQ(allocated, 9);
+    EXPECT_EQ(moved.size(), 9);
+  }
+  EXPECT_EQ(allocated, 0);
+}
+
+TEST(bimap, allocator_propagation) {
+  using allocator_t = counting_allocator<std::pair<int, int>>;
+  using bimap_t = bimap<int, int, std::less<>, std::less<>, allocator_t>;
+  size_t allocated_a = 0, allocated_b = 0;
+  {
+    bimap_t a((allocator_t(&allocated_a))), b((allocator_t(&allocated_b)));
+    for (int i = 0; i < 10; i++) {
+      a.insert(i, i + 100);
+    }
+    for (int i = 0; i < 3; i++) {
+      b.insert(i + 200, i);
+    }
+
+    // counting_allocator does not propagate, so each bimap keeps its own.
+    a.swap(b);
+    EXPECT_EQ(allocated_a, 3);
+    EXPECT_EQ(allocated_b, 10);
+    EXPECT_EQ(a.size(), 3);
+    EXPECT_EQ(b.at_left(5), 105);
+    EXPECT_EQ(a.get_allocator(), allocator_t(&allocated_a));
+
+    a = b;
+    EXPECT_EQ(allocated_a, 10);
+    EXPECT_EQ(allocated_b, 10);
+    EXPECT_EQ(a, b);
+    EXPECT_EQ(a.get_allocator(), allocator_t(&allocated_a));
+
+    b.clear();
+    b.insert(1, 1);
+    a = std::move(b);
+    EXPECT_EQ(allocated_a, 1);
+    EXPECT_EQ(a.at_left(1), 1);
+    EXPECT_EQ(a.get_allocator(), allocator_t(&allocated_a));
+  }
+  EXPECT_EQ(allocated_a, 0);
+  EXPECT_EQ(allocated_b, 0);
+}
+
+TEST(bimap, pool_allocator) {
+  using allocator_t = pool_allocator<std::pair<int, int>, 16>;
+  bimap<int, int, std::less<>, std::less<>, allocator_t> b;
+  std::map<int, int> left_view;
+
+  std::mt19937 e(1488228);
+  for (size_t i = 0; i < 1000; i++) {
+    int l = e() % 200, r = e() % 200;
+    if (e() % 3 == 0) {
+      left_view.erase(l);
+      b.erase_left(l);
+    } else if (b.insert(l, r) != b.end_left()) {
+      left_view.insert({l, r});
+    }
+  }
+
+  EXPECT_EQ(b.size(), left_view.size());
+  auto lit = b.begin_left();
+  for (auto const& p : left_view) {
+    EXPECT_EQ(*lit, p.first);
+    EXPECT_EQ(*lit.flip(), p.second);
+    ++lit;
+  }
+
+  auto copy = b;
+  EXPECT_EQ(copy, b);
+  b.clear();
+  EXPECT_EQ(copy.size(), left_view.size());
+}
+
+TEST(bimap, node_size) {
+  using int_node = bimap_impl::bimap_node<int, int>;
+  using string_node = bimap_impl::bimap_node<std::string, uint64_t>;
+  std::cout << "sizeof(bimap_node<int, int>) = " << sizeof(int_node)
+            << ", sizeof(bimap_node<std::string, uint64_t>) = " << sizeof(string_node)
+            << std::endl;
+#ifdef BIMAP_COMPACT_NODES
+  if (sizeof(void *) == 8) {
+    EXPECT_EQ(sizeof(int_node), 64);
+    EXPECT_LE(sizeof(string_node), 2 * 32 + sizeof(std::string) + sizeof(uint64_t));
+  }
+#endif
+}
+
 TEST(bimap, lower_bound) {
   bimap<int, int> b;
 
@@ -310,6 +610,82 @@ TEST(bimap, equivalence) {
   EXPECT_EQ(a.end_right().flip(), a.end_left());
 }
 
+TEST(bimap, order_statistics) {
+  bimap<int, int, std::less<int>, std::greater<int>> b;
+  EXPECT_EQ(b.nth_left(0), b.end_left());
+  EXPECT_EQ(b.rank_right(5), 0);
+  EXPECT_EQ(b.distance(b.begin_left(), b.end_left()), 0);
+
+  for (int i = 0; i < 10; i++) {
+    b.insert(i * 10, i);
+  }
+  EXPECT_EQ(*b.nth_left(0), 0);
+  EXPECT_EQ(*b.nth_left(7), 70);
+  EXPECT_EQ(b.nth_left(10), b.end_left());
+  EXPECT_EQ(*b.nth_right(0), 9);
+  EXPECT_EQ(*b.nth_right(9).flip(), 0);
+
+  EXPECT_EQ(b.rank_left(-5), 0);
+  EXPECT_EQ(b.rank_left(30), 3);
+  EXPECT_EQ(b.rank_left(35), 4);
+  EXPECT_EQ(b.rank_left(1000), 10);
+  EXPECT_EQ(b.rank_right(7), 2);
+
+  EXPECT_EQ(b.distance(b.begin_left(), b.end_left()), 10);
+  EXPECT_EQ(b.distance(b.find_left(50), b.find_left(20)), -3);
+  EXPECT_EQ(b.distance(b.begin_right(), b.find_right(0)), 9);
+}
+
+TEST(bimap, freeze) {
+  bimap<int, std::string, std::less<>, std::greater<>> b;
+  auto empty = b.freeze();
+  EXPECT_EQ(empty.find_left(1), b.end_left());
+  EXPECT_EQ(empty.lower_bound_right("a"), b.end_right());
+
+  for (int i = 0; i < 10; i++) {
+    b.insert(i * 2, std::string(1, char('a' + i)));
+  }
+  auto f = b.freeze();
+  EXPECT_EQ(*f.find_left(4).flip(), "c");
+  EXPECT_EQ(f.find_left(5), b.end_left());
+  EXPECT_EQ(*f.find_right("j").flip(), 18);
+  EXPECT_EQ(f.find_right("z"), b.end_right());
+  EXPECT_EQ(*f.lower_bound_left(5), 6);
+  EXPECT_EQ(*f.upper_bound_left(6), 8);
+  EXPECT_EQ(f.lower_bound_left(19), b.end_left());
+  EXPECT_EQ(f.upper_bound_left(-1), b.begin_left());
+  EXPECT_EQ(*f.lower_bound_right("cc"), "c");
+  EXPECT_EQ(*f.upper_bound_right("c"), "b");
+  EXPECT_EQ(f.upper_bound_right("a"), b.end_right());
+  EXPECT_EQ(*f.find_left(4L).flip(), "c");
+}
+
+TEST(bimap, find_batch) {
+  bimap<int, std::string, std::less<>> b;
+  for (int i = 0; i < 100; i++) {
+    b.insert(i * 3, std::to_string(i));
+  }
+  std::vector<long> keys{9, 10, 297, 0, 300, -3, 9};
+  std::vector<bimap<int, std::string, std::less<>>::left_iterator> found;
+  b.find_left_batch(keys.begin(), keys.end(), std::back_inserter(found));
+  ASSERT_EQ(found.size(), keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    EXPECT_EQ(found[i], b.find_left(keys[i]));
+  }
+
+  std::vector<std::string> rights{"5", "99", "0"};
+  std::vector<int> lefts;
+  b.at_right_batch(rights.begin(), rights.end(), std::back_inserter(lefts));
+  EXPECT_EQ(lefts, std::vector<int>({15, 297, 0}));
+  std::vector<std::string> values(2);
+  EXPECT_EQ(b.at_left_batch(keys.begin(), keys.begin() + 1, values.begin()), values.begin() + 1);
+  EXPECT_EQ(values[0], "3");
+  EXPECT_THROW(b.at_left_batch(keys.begin(), keys.end(), values.begin()), std::out_of_range);
+  std::vector<bimap<int, std::string, std::less<>>::right_iterator> found_rights;
+  b.find_right_batch(rights.begin(), rights.begin(), std::back_inserter(found_rights));
+  EXPECT_TRUE(found_rights.empty());
+}
+
 TEST(bimap, iterator_ops) {
   bimap<int, int> b;
   b.insert(3, 4);
@@ -334,6 +710,616 @@ TEST(bimap, swap) {
   EXPECT_EQ(*b.find_right(3), 3);
 }
 
+TEST(bimap, node_handle) {
+  using allocator_t = counting_allocator<std::pair<int, std::string>>;
+  using bimap_t = bimap<int, std::string, std::less<>, std::less<>, allocator_t>;
+  size_t allocated = 0;
+  {
+    bimap_t b((allocator_t(&allocated))), b1((allocator_t(&allocated)));
+    b.insert(1, "a");
+    b.insert(2, "b");
+    b.insert(3, "c");
+    b1.insert(4, "b");
+    EXPECT_EQ(allocated, 4);
+
+    auto node = b.extract_left(2);
+    EXPECT_FALSE(node.empty());
+    EXPECT_EQ(node.left(), 2);
+    EXPECT_EQ(node.right(), "b");
+    EXPECT_EQ(b.size(), 2);
+    EXPECT_EQ(b.find_right("b"), b.end_right());
+
+    EXPECT_EQ(b1.insert(std::move(node)), b1.end_left());
+    EXPECT_TRUE(node);
+    node.right() = "d";
+    auto it = b1.insert(std::move(node));
+    EXPECT_TRUE(node.empty());
+    EXPECT_EQ(*it, 2);
+    EXPECT_EQ(*it.flip(), "d");
+    EXPECT_EQ(b1.size(), 2);
+
+    EXPECT_TRUE(b.extract_right("x").empty());
+    node = b.extract_right(b.find_right("c"));
+    EXPECT_EQ(node.left(), 3);
+    EXPECT_EQ(allocated, 4);
+  }
+  EXPECT_EQ(allocated, 0);
+}
+
+TEST(bimap, merge) {
+  using allocator_t = counting_allocator<std::pair<int, int>>;
+  using bimap_t = bimap<int, int, std::less<>, std::less<>, allocator_t>;
+  size_t allocated = 0;
+  bimap_t b((allocator_t(&allocated))), b1((allocator_t(&allocated)));
+  for (int i = 0; i < 10; i += 2) {
+    b.insert(i, i);
+  }
+  for (int i = 0; i < 10; i++) {
+    b1.insert(i, 10 - i);
+  }
+  b1.insert(11, 0);
+  b.merge(b1);
+  EXPECT_EQ(allocated, 16);
+  EXPECT_EQ(b.size(), 10);
+  EXPECT_EQ(b.at_left(1), 9);
+  EXPECT_EQ(b.at_left(5), 5);
+  EXPECT_EQ(b.at_left(4), 4);
+  EXPECT_EQ(b1.size(), 6);
+  EXPECT_EQ(b1.find_left(1), b1.end_left());
+  EXPECT_EQ(b1.at_left(6), 4);
+  EXPECT_EQ(b1.at_left(11), 0);
+
+  b.merge(b);
+  EXPECT_EQ(b.size(), 10);
+}
+
+TEST(bimap, set_operations) {
+  using pairs_t = std::vector<std::pair<int, int>>;
+  bimap<int, int> a, b;
+  a.insert(1, 1);
+  a.insert(2, 2);
+  a.insert(3, 3);
+  a.insert(4, 4);
+  b.insert(1, 1);
+  b.insert(2, 5);
+  b.insert(5, 3);
+  b.insert(6, 6);
+
+  bimap<int, int> c = a;
+  pairs_t conflicts;
+  c.unite(b, std::back_inserter(conflicts));
+  std::sort(conflicts.begin(), conflicts.end());
+  EXPECT_EQ(conflicts, (pairs_t{{2, 5}, {5, 3}}));
+  EXPECT_EQ(c.size(), 5);
+  EXPECT_EQ(c.at_left(2), 2);
+  EXPECT_EQ(c.at_left(6), 6);
+  EXPECT_EQ(b.size(), 4);
+
+  c = a;
+  c.intersect(b);
+  EXPECT_EQ(c.size(), 1);
+  EXPECT_EQ(c.at_left(1), 1);
+  EXPECT_EQ(c.at_right(1), 1);
+
+  c = a;
+  conflicts.clear();
+  c.subtract(b, std::back_inserter(conflicts));
+  EXPECT_EQ(conflicts.size(), 2);
+  EXPECT_EQ(c.size(), 3);
+  EXPECT_EQ(c.find_left(1), c.end_left());
+  EXPECT_EQ(c.find_right(1), c.end_right());
+
+  c = a;
+  bimap<int, int> d = b;
+  c.merge(d);
+  EXPECT_EQ(c.size(), 5);
+  EXPECT_EQ(d.size(), 3);
+  EXPECT_EQ(d.at_left(5), 3);
+  EXPECT_EQ(d.find_left(6), d.end_left());
+
+  c.subtract(c);
+  EXPECT_TRUE(c.empty());
+}
+
+TEST(bimap, diff) {
+  using change_kind = bimap<int, int>::change_kind;
+  using change_t = std::tuple<change_kind, int, int>;
+  bimap<int, int> a, b;
+  a.insert(1, 1);
+  a.insert(2, 2);
+  a.insert(3, 3);
+  b.insert(2, 2);
+  b.insert(3, 4);
+  b.insert(4, 1);
+
+  std::vector<change_t> changes;
+  diff(a, b, [&](auto kind, int left, int right) { changes.emplace_back(kind, left, right); });
+  EXPECT_EQ(changes, (std::vector<change_t>{{change_kind::removed, 1, 1},
+                                            {change_kind::remapped, 3, 4},
+                                            {change_kind::inserted, 4, 1}}));
+  changes.clear();
+  diff(a, a, [&](auto kind, int left, int right) { changes.emplace_back(kind, left, right); });
+  EXPECT_TRUE(changes.empty());
+}
+
+TEST(bimap, replace) {
+  bimap<int, std::string> b;
+  auto it = b.insert(1, "a");
+  b.insert(2, "b");
+  b.insert(3, "c");
+
+  auto right = it.flip();
+  auto replaced = b.replace_left(it, 5);
+  EXPECT_EQ(replaced, it);
+  EXPECT_EQ(*it, 5);
+  EXPECT_EQ(*--b.end_left(), 5);
+  EXPECT_EQ(*b.begin_left(), 2);
+  EXPECT_EQ(right.flip(), it);
+
+  EXPECT_EQ(b.replace_left(it, 2), b.end_left());
+  EXPECT_EQ(*it, 5);
+  EXPECT_EQ(b.replace_left(it, 5), it);
+
+  auto rit = b.replace_right(b.find_right("b"), "z");
+  EXPECT_EQ(*rit.flip(), 2);
+  EXPECT_EQ(*--b.end_right(), "z");
+  EXPECT_EQ(b.replace_right(rit, "a"), b.end_right());
+  EXPECT_EQ(b.at_right("a"), 5);
+  EXPECT_EQ(b.size(), 3);
+}
+
+TEST(flat_bimap, simple) {
+  flat_bimap<int, std::string> b;
+  b.insert(4, "a");
+  b.insert(1, "c");
+  auto it = b.insert(4, "b");
+  EXPECT_EQ(it, b.end_left());
+  it = b.insert(2, "a");
+  EXPECT_EQ(it, b.end_left());
+  it = b.insert(3, "b");
+  EXPECT_EQ(*it.flip(), "b");
+
+  EXPECT_EQ(b.size(), 3);
+  EXPECT_EQ(b.at_left(4), "a");
+  EXPECT_EQ(b.at_right("b"), 3);
+  EXPECT_THROW(b.at_left(2), std::out_of_range);
+  EXPECT_EQ(*b.find_right("c").flip(), 1);
+  EXPECT_EQ(b.end_left().flip(), b.end_right());
+  EXPECT_EQ(*b.lower_bound_left(2), 3);
+  EXPECT_EQ(*b.upper_bound_right("a"), "b");
+
+  std::vector<int> lefts;
+  for (auto it = b.begin_right(); it != b.end_right(); it++) {
+    EXPECT_EQ(it.flip().flip(), it);
+    lefts.push_back(*it.flip());
+  }
+  EXPECT_EQ(lefts, std::vector<int>({4, 3, 1}));
+
+  EXPECT_TRUE(b.erase_right("b"));
+  EXPECT_FALSE(b.erase_left(3));
+  EXPECT_EQ(b.at_left(4), "a");
+  EXPECT_EQ(b.at_right("c"), 1);
+  EXPECT_EQ(b.at_left_or_default(5), "");
+  EXPECT_EQ(b.at_right_or_default("z"), 0);
+  EXPECT_EQ(b.size(), 4);
+}
+
+TEST(flat_bimap, erase_range) {
+  flat_bimap<int, int> b;
+  for (int i = 0; i < 10; i++) {
+    b.insert(i, 100 - i * 7 % 10);
+  }
+  auto it = b.erase_right(b.lower_bound_right(93), b.upper_bound_right(96));
+  EXPECT_EQ(*it, 97);
+  EXPECT_EQ(b.size(), 6);
+  for (auto l = b.begin_left(); l != b.end_left(); l++) {
+    EXPECT_EQ(*l.flip(), 100 - *l * 7 % 10);
+    EXPECT_EQ(l.flip().flip(), l);
+  }
+  b.erase_left(b.begin_left(), b.end_left());
+  EXPECT_TRUE(b.empty());
+}
+
+TEST(flat_bimap, insert_range) {
+  std::vector<std::pair<int, int>> pairs{{3, 1}, {1, 2}, {3, 4}, {5, 2}, {6, 6}, {0, 7}};
+  flat_bimap<int, int, std::greater<>> b(pairs.begin(), pairs.end());
+  EXPECT_EQ(b.size(), 4);
+  pairs = {{8, 6}, {0, 9}, {9, 9}, {10, 10}, {4, 3}};
+  b.insert(pairs.begin(), pairs.end());
+
+  std::vector<std::pair<int, int>> content;
+  for (auto it = b.begin_left(); it != b.end_left(); it++) {
+    content.emplace_back(*it, *it.flip());
+  }
+  std::vector<std::pair<int, int>> expected{{10, 10}, {9, 9}, {6, 6}, {4, 3}, {3, 1}, {1, 2}, {0, 7}};
+  EXPECT_EQ(content, expected);
+  for (auto it = b.begin_right(); it != b.end_right(); it++) {
+    EXPECT_EQ(it.flip().flip(), it);
+  }
+}
+
+namespace {
+int copies_left = -1;
+
+struct fragile {
+  int value;
+
+  fragile(int value) : value(value) {}
+
+  fragile(fragile const& other) : value(other.value) {
+    if (copies_left == 0) {
+      throw std::runtime_error("copy failed");
+    }
+    --copies_left;
+  }
+
+  friend bool operator<(fragile const& a, fragile const& b) {
+    return a.value < b.value;
+  }
+};
+}
+
+TEST(flat_bimap, insert_range_exception) {
+  std::vector<std::pair<std::string, fragile>> pairs;
+  for (int i = 0; i < 10; i++) {
+    pairs.emplace_back(std::to_string(i), fragile(i));
+  }
+  flat_bimap<std::string, fragile> b(pairs.begin(), pairs.begin() + 5);
+
+  // Fails at every copy in turn until the insert goes through.
+  for (int copies = 0;; copies++) {
+    copies_left = copies;
+    try {
+      b.insert(pairs.begin() + 5, pairs.end());
+      break;
+    } catch (std::runtime_error const&) {
+    }
+    copies_left = -1;
+    ASSERT_EQ(b.size(), 5);
+    int i = 0;
+    for (auto it = b.begin_left(); it != b.end_left(); it++, i++) {
+      EXPECT_EQ(*it, std::to_string(i));
+      EXPECT_EQ(it.flip()->value, i);
+    }
+  }
+  copies_left = -1;
+  EXPECT_EQ(b.size(), 10);
+}
+
+TEST(concurrent_bimap, simple) {
+  concurrent_bimap<int, std::string> b;
+  EXPECT_TRUE(b.empty());
+  EXPECT_TRUE(b.insert(1, "a"));
+  EXPECT_TRUE(b.insert(2, "b"));
+  EXPECT_FALSE(b.insert(1, "c"));
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(b.find_left(1), "a");
+  EXPECT_EQ(b.find_right("b"), 2);
+  EXPECT_EQ(b.find_left(3), std::nullopt);
+  EXPECT_EQ(b.at_right("a"), 1);
+  EXPECT_THROW(b.at_left(3), std::out_of_range);
+  EXPECT_TRUE(b.erase_right("a"));
+  EXPECT_FALSE(b.erase_left(1));
+  EXPECT_EQ(b.write([](auto &m) { return m.at_left_or_default(5); }), "");
+  EXPECT_EQ(b.read([](auto const &m) { return *m.begin_left(); }), 2);
+  EXPECT_EQ(b.at_right(""), 5);
+  b.clear();
+  EXPECT_EQ(b.size(), 0);
+}
+
+TEST(concurrent_bimap, throwing_write) {
+  concurrent_bimap<int, int> b;
+  b.insert(1, 1);
+  b.insert(2, 2);
+  auto contents = [&b] {
+    return b.read([](auto const &m) {
+      std::vector<std::pair<int, int>> result;
+      for (auto it = m.begin_left(); it != m.end_left(); ++it) {
+        result.emplace_back(*it, *it.flip());
+      }
+      return result;
+    });
+  };
+
+  EXPECT_THROW(b.write([](auto &m) {
+    m.insert(3, 3);
+    throw std::runtime_error("first");
+  }), std::runtime_error);
+  std::vector<std::pair<int, int>> expected{{1, 1}, {2, 2}};
+  EXPECT_EQ(contents(), expected);
+  // Every write publishes the other copy, so two writes look at both of them.
+  b.insert(4, 4);
+  expected.emplace_back(4, 4);
+  EXPECT_EQ(contents(), expected);
+  b.insert(5, 5);
+  expected.emplace_back(5, 5);
+  EXPECT_EQ(contents(), expected);
+
+  size_t calls = 0;
+  EXPECT_EQ(b.write([&calls](auto &m) {
+    m.insert(6, 6);
+    if (++calls == 2) {
+      throw std::runtime_error("second");
+    }
+    return calls;
+  }), 1);
+  expected.emplace_back(6, 6);
+  EXPECT_EQ(contents(), expected);
+  b.insert(7, 7);
+  expected.emplace_back(7, 7);
+  EXPECT_EQ(contents(), expected);
+  b.insert(8, 8);
+  expected.emplace_back(8, 8);
+  EXPECT_EQ(contents(), expected);
+}
+
+TEST(sharded_bimap, simple) {
+  sharded_bimap<int, std::string> b(8);
+  EXPECT_TRUE(b.empty());
+  EXPECT_TRUE(b.insert(1, "a"));
+  EXPECT_TRUE(b.insert(2, "b"));
+  EXPECT_FALSE(b.insert(1, "c"));
+  EXPECT_FALSE(b.insert(3, "a"));
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(b.find_left(2), "b");
+  EXPECT_EQ(b.find_right("a"), 1);
+  EXPECT_EQ(b.find_right("c"), std::nullopt);
+  EXPECT_THROW(b.at_left(3), std::out_of_range);
+  EXPECT_TRUE(b.erase_right("a"));
+  EXPECT_FALSE(b.erase_left(1));
+  EXPECT_TRUE(b.insert(3, "a"));
+  EXPECT_EQ(b.at_right("a"), 3);
+  EXPECT_TRUE(b.erase_left(2));
+  EXPECT_EQ(b.size(), 1);
+}
+
+TEST(persistent_bimap, snapshot) {
+  persistent_bimap<int, std::string> b;
+  EXPECT_NE(b.insert(1, "a"), b.end_left());
+  EXPECT_NE(b.insert(2, "b"), b.end_left());
+  EXPECT_EQ(b.insert(2, "c"), b.end_left());
+  auto old = b.snapshot();
+
+  EXPECT_TRUE(b.erase_left(1));
+  EXPECT_EQ(*b.insert(3, "a").flip(), "a");
+  EXPECT_FALSE(b.erase_right("z"));
+
+  EXPECT_EQ(old.size(), 2);
+  EXPECT_EQ(old.at_right("a"), 1);
+  EXPECT_EQ(old.at_left(2), "b");
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(b.at_right("a"), 3);
+  EXPECT_THROW(b.at_left(1), std::out_of_range);
+  EXPECT_NE(b, old);
+  EXPECT_EQ(old, old.snapshot());
+
+  EXPECT_EQ(*b.lower_bound_left(2), 2);
+  EXPECT_EQ(*b.upper_bound_left(2), 3);
+  EXPECT_EQ(b.upper_bound_right("b"), b.end_right());
+  EXPECT_EQ(b.end_left().flip(), b.end_right());
+  auto it = b.end_right();
+  EXPECT_EQ(*--it, "b");
+  EXPECT_EQ(*--it, "a");
+  EXPECT_EQ(it, b.begin_right());
+  EXPECT_EQ(it.flip().flip(), it);
+  b.clear();
+  EXPECT_TRUE(b.empty());
+  EXPECT_EQ(old.find_left(1).flip(), old.find_right("a"));
+}
+
+TEST(persistent_bimap, diff) {
+  using change_kind = persistent_bimap<int, int>::change_kind;
+  using change_t = std::tuple<change_kind, int, int>;
+  persistent_bimap<int, int, counting_less, counting_less> b;
+  for (int i = 0; i < 1000; i++) {
+    b.insert(i, i);
+  }
+  auto old = b.snapshot();
+  b.erase_left(10);
+  b.insert(10, 2000);
+  b.insert(5000, 5000);
+
+  std::vector<change_t> changes;
+  counting_less::calls = 0;
+  diff(old, b, [&](auto kind, int left, int right) { changes.emplace_back(kind, left, right); });
+  EXPECT_LT(counting_less::calls, 200);
+  EXPECT_EQ(changes, (std::vector<change_t>{{change_kind::remapped, 10, 2000},
+                                            {change_kind::inserted, 5000, 5000}}));
+
+  changes.clear();
+  diff(b, persistent_bimap<int, int, counting_less, counting_less>(),
+       [&](auto kind, int left, int right) { changes.emplace_back(kind, left, right); });
+  EXPECT_EQ(changes.size(), 1001);
+  EXPECT_EQ(std::get<0>(changes.back()), change_kind::removed);
+}
+
+TEST(mapped_bimap, save_load) {
+  bimap<int, double> b;
+  b.insert(3, 0.5);
+  b.insert(1, 2.5);
+  b.insert(2, 1.5);
+  std::stringstream stream;
+  b.save(stream);
+  std::string data = stream.str();
+
+  auto loaded = bimap<int, double>::load(stream);
+  EXPECT_EQ(loaded, b);
+  EXPECT_EQ(loaded.at_right(2.5), 1);
+
+  std::vector<uint64_t> buffer(data.size() / sizeof(uint64_t) + 1);
+  std::memcpy(buffer.data(), data.data(), data.size());
+  mapped_bimap<int, double> m(buffer.data(), data.size());
+  EXPECT_EQ(m.size(), 3);
+  EXPECT_EQ(m.at_left(2), 1.5);
+  EXPECT_EQ(m.at_right(0.5), 3);
+  EXPECT_THROW(m.at_left(4), std::out_of_range);
+  EXPECT_EQ(*m.lower_bound_right(1.0), 1.5);
+  EXPECT_EQ(m.upper_bound_left(3), m.end_left());
+  EXPECT_EQ(m.end_right().flip(), m.end_left());
+  EXPECT_EQ(*m.begin_right().flip(), 3);
+  EXPECT_EQ(m.find_left(1).flip(), m.find_right(2.5));
+
+  EXPECT_THROW((mapped_bimap<int, float>(buffer.data(), data.size())), std::runtime_error);
+  EXPECT_THROW((mapped_bimap<int, double>(buffer.data(), data.size() - 1)), std::runtime_error);
+  auto const& header = *reinterpret_cast<bimap_impl::file_header const*>(buffer.data());
+  auto* rights = reinterpret_cast<bimap_impl::file_record<double>*>(
+      reinterpret_cast<char*>(buffer.data()) + header.right_offset);
+  rights[1].position = 3;
+  EXPECT_THROW((mapped_bimap<int, double>(buffer.data(), data.size())), std::runtime_error);
+  std::stringstream truncated(data.substr(0, data.size() - 1));
+  EXPECT_THROW((bimap<int, double>::load(truncated)), std::runtime_error);
+  std::stringstream reordered(data);
+  EXPECT_THROW((bimap<int, double, std::greater<int>>::load(reordered)), std::runtime_error);
+}
+
+struct constant_hash {
+  size_t operator()(int) const {
+    return 42;
+  }
+};
+
+TEST(unordered_bimap, simple) {
+  unordered_bimap<int, std::string> b;
+  EXPECT_NE(b.insert(1, "a"), b.end_left());
+  EXPECT_NE(b.insert(2, "b"), b.end_left());
+  EXPECT_EQ(b.insert(2, "c"), b.end_left());
+  EXPECT_EQ(b.insert(3, "a"), b.end_left());
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(b.at_left(1), "a");
+  EXPECT_EQ(b.at_right("b"), 2);
+  EXPECT_THROW(b.at_left(3), std::out_of_range);
+  EXPECT_EQ(b.find_left(1).flip(), b.find_right("a"));
+  EXPECT_EQ(b.end_left().flip(), b.end_right());
+  EXPECT_EQ(b.find_right("z"), b.end_right());
+
+  unordered_bimap<int, std::string> copy(b);
+  EXPECT_TRUE(b.erase_left(1));
+  EXPECT_FALSE(b.erase_right("a"));
+  EXPECT_EQ(b.erase_right(b.find_right("b")), b.end_right());
+  EXPECT_TRUE(b.empty());
+  EXPECT_EQ(copy.size(), 2);
+  EXPECT_EQ(copy.at_right("a"), 1);
+  EXPECT_NE(b, copy);
+  b = copy;
+  EXPECT_EQ(b, copy);
+  EXPECT_TRUE(b.erase_left(2));
+  EXPECT_EQ(*b.begin_left(), 1);
+  EXPECT_EQ(++b.begin_left(), b.end_left());
+}
+
+TEST(unordered_bimap, collisions) {
+  unordered_bimap<int, int, constant_hash, constant_hash> b;
+  for (int i = 0; i < 100; i++) {
+    b.insert(i, 1000 - i);
+  }
+  EXPECT_EQ(b.size(), 100);
+  for (int i = 0; i < 100; i += 3) {
+    EXPECT_TRUE(b.erase_left(i));
+  }
+  size_t count = 0;
+  for (auto it = b.begin_left(); it != b.end_left(); it++, count++) {
+    EXPECT_NE(*it % 3, 0);
+    EXPECT_EQ(*it.flip(), 1000 - *it);
+  }
+  EXPECT_EQ(count, b.size());
+  EXPECT_EQ(b.at_right(999), 1);
+  b.clear();
+  EXPECT_EQ(b.begin_right(), b.end_right());
+}
+
+TEST(indexed_bimap, hybrid) {
+  indexed_bimap<int, std::string, ordered_index<>, hashed_index<>> b;
+  EXPECT_NE(b.insert(3, "c"), b.end_left());
+  EXPECT_NE(b.insert(1, "a"), b.end_left());
+  EXPECT_NE(b.insert(2, "b"), b.end_left());
+  EXPECT_EQ(b.insert(4, "a"), b.end_left());
+  EXPECT_EQ(b.at_right("b"), 2);
+  EXPECT_EQ(b.at_left(3), "c");
+  EXPECT_THROW(b.at_right("z"), std::out_of_range);
+  EXPECT_EQ(*b.lower_bound_left(2).flip(), "b");
+  EXPECT_EQ(b.upper_bound_left(3), b.end_left());
+  EXPECT_EQ(b.end_left().flip(), b.end_right());
+  EXPECT_EQ(b.end_right().flip(), b.end_left());
+  EXPECT_EQ(b.find_right("a").flip(), b.begin_left());
+  auto it = b.end_left();
+  EXPECT_EQ(*--it, 3);
+
+  auto copy = b;
+  EXPECT_EQ(b.erase_left(b.find_left(2)), b.find_left(3));
+  EXPECT_TRUE(b.erase_right("c"));
+  EXPECT_FALSE(b.erase_left(3));
+  EXPECT_EQ(b.size(), 1);
+  EXPECT_EQ(copy.size(), 3);
+  EXPECT_NE(b, copy);
+  b = copy;
+  EXPECT_EQ(b, copy);
+
+  indexed_bimap<int, int, hashed_index<>, ordered_index<std::greater<int>>> r(
+      hashed_index<>(), ordered_index<std::greater<int>>{std::greater<int>()});
+  r.insert(1, 10);
+  r.insert(2, 30);
+  r.insert(3, 20);
+  EXPECT_EQ(*r.begin_right(), 30);
+  EXPECT_EQ(*r.lower_bound_right(25).flip(), 3);
+  EXPECT_EQ(r.at_left(1), 10);
+
+  indexed_bimap<int, int, ordered_index<>, hashed_index<void, std::equal_to<>>> q(
+      ordered_index<>(), hashed_index<void, std::equal_to<>>{std::equal_to<>()});
+  q.insert(1, 10);
+  q.insert(2, 20);
+  EXPECT_EQ(q.at_right(20), 2);
+  auto q_copy = q;
+  EXPECT_EQ(q_copy, q);
+}
+
+struct picky_hash {
+  size_t operator()(int value) const {
+    if (value == 13) {
+      throw std::runtime_error("unlucky");
+    }
+    return std::hash<int>()(value);
+  }
+};
+
+TEST(indexed_bimap, insert_range) {
+  std::vector<std::pair<int, int>> pairs{{3, 30}, {1, 10}, {2, 30}, {4, 40}, {1, 50}, {5, 50}};
+  auto check = [&pairs](auto b) {
+    b.insert(pairs.begin(), pairs.end());
+    EXPECT_EQ(b.size(), 4);
+    EXPECT_EQ(b.at_left(1), 10);
+    EXPECT_EQ(b.at_left(3), 30);
+    EXPECT_EQ(b.at_right(40), 4);
+    EXPECT_EQ(b.at_right(50), 5);
+    EXPECT_EQ(b.find_left(2), b.end_left());
+
+    for (int i = 100; i < 1100; i++) {
+      b.insert(i, i);
+    }
+    std::vector<std::pair<int, int>> few{{6, 60}, {100, 70}, {7, 60}};
+    b.insert(few.begin(), few.end());
+    EXPECT_EQ(b.size(), 1005);
+    EXPECT_EQ(b.at_right(60), 6);
+    EXPECT_EQ(b.find_right(70), b.end_right());
+    EXPECT_EQ(decltype(b)(b), b);
+  };
+  check(indexed_bimap<int, int>());
+  check(indexed_bimap<int, int, ordered_index<>, hashed_index<>>());
+  check(indexed_bimap<int, int, hashed_index<>, ordered_index<>>());
+  check(indexed_bimap<int, int, hashed_index<>, hashed_index<>>());
+
+  indexed_bimap<int, int, ordered_index<>, hashed_index<picky_hash>> b;
+  std::vector<std::pair<int, int>> unlucky{{1, 10}, {2, 13}, {3, 30}};
+  EXPECT_THROW(b.insert(unlucky.begin(), unlucky.end()), std::runtime_error);
+  EXPECT_TRUE(b.empty());
+  for (int i = 100; i < 1100; i++) {
+    b.insert(i, i);
+  }
+  EXPECT_THROW(b.insert(unlucky.begin(), unlucky.end()), std::runtime_error);
+  EXPECT_EQ(b.size(), 1000);
+  EXPECT_EQ(b.find_left(1), b.end_left());
+  EXPECT_EQ(b.find_right(10), b.end_right());
+}
+
 template <typename T>
 std::vector<std::pair<T, T>>
 eliminate_same(std::vector<T> &lefts, std::vector<T> &rights, std::mt19937 &e) {
@@ -474,6 +1460,16 @@ TEST(bimap_randomized, compare_to_two_maps) {
         EXPECT_EQ(*lit, mlit->first);
         EXPECT_EQ(*lit.flip(), mlit->second);
       }
+      size_t index = e() % (b.size() + 1);
+      auto rit = right_view.begin();
+      std::advance(rit, index);
+      auto nth = b.nth_right(index);
+      EXPECT_EQ(rit == right_view.end(), nth == b.end_right());
+      if (rit != right_view.end()) {
+        EXPECT_EQ(*nth, rit->first);
+        EXPECT_EQ(b.rank_right(rit->first), index);
+      }
+      EXPECT_EQ(b.distance(nth, b.end_right()), b.size() - index);
     }
   }
   std::cout << "Comparing to maps stat:" << std::endl;
@@ -481,3 +1477,1291 @@ TEST(bimap_randomized, compare_to_two_maps) {
             << " erasures. " << skip << " skipped." << std::endl;
 }
 
+// The set operations done pair by pair with lookups.
+template <typename Bimap>
+std::vector<std::pair<int, int>> reference_set_operation(Bimap& a, Bimap const& b, int operation) {
+  std::vector<std::pair<int, int>> conflicts, erased;
+  for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+    auto left = a.find_left(*it);
+    auto right = a.find_right(*it.flip());
+    bool equal = left != a.end_left() && *left.flip() == *it.flip();
+    if (!equal && (left != a.end_left() || right != a.end_right())) {
+      conflicts.emplace_back(*it, *it.flip());
+    }
+    if (operation == 0 && left == a.end_left() && right == a.end_right()) {
+      a.insert(*it, *it.flip());
+    }
+    if (operation == 2 && equal) {
+      a.erase_left(left);
+    }
+  }
+  if (operation == 1) {
+    for (auto it = a.begin_left(); it != a.end_left();) {
+      auto found = b.find_left(*it);
+      if (found == b.end_left() || *found.flip() != *it.flip()) {
+        it = a.erase_left(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  std::sort(conflicts.begin(), conflicts.end());
+  return conflicts;
+}
+
+TEST(bimap_randomized, set_operations) {
+  std::cout << "Seed used for randomized set operations test is " << seed << std::endl;
+  std::mt19937 e(seed);
+  for (size_t round = 0; round < 60; round++) {
+    size_t a_size = e() % 3000, b_size = round % 3 == 0 ? e() % 3000 : e() % 20;
+    int range = int(e() % 4000) + 1;
+    bimap<int, int> a, b;
+    for (size_t i = 0; i < a_size; i++) {
+      a.insert(int(e() % range), int(e() % range));
+    }
+    if (round % 3 == 2) {
+      b = a;
+      for (size_t i = 0; i < b_size && !b.empty(); i++) {
+        b.erase_left(b.nth_left(e() % b.size()));
+      }
+    }
+    for (size_t i = 0; i < b_size; i++) {
+      b.insert(int(e() % range), int(e() % range));
+    }
+    int operation = int(round / 3 % 4);
+    bimap<int, int> expected = a, result = a, other = b;
+    std::vector<std::pair<int, int>> expected_conflicts =
+        reference_set_operation(expected, b, operation == 3 ? 0 : operation);
+    std::vector<std::pair<int, int>> conflicts;
+    if (operation == 0) {
+      result.unite(b, std::back_inserter(conflicts));
+    } else if (operation == 1) {
+      result.intersect(b, std::back_inserter(conflicts));
+    } else if (operation == 2) {
+      result.subtract(b, std::back_inserter(conflicts));
+    } else {
+      result.merge(other, std::back_inserter(conflicts));
+      EXPECT_EQ(other.size() + result.size(), a.size() + b.size());
+      for (auto it = other.begin_left(); it != other.end_left(); ++it) {
+        EXPECT_EQ(b.at_left(*it), *it.flip());
+        EXPECT_EQ(other.at_right(*it.flip()), *it);
+      }
+    }
+    std::sort(conflicts.begin(), conflicts.end());
+    EXPECT_EQ(conflicts, expected_conflicts);
+    EXPECT_TRUE(result == expected);
+    ASSERT_EQ(result.size(), expected.size());
+    auto rit = result.begin_right();
+    for (auto it = expected.begin_right(); it != expected.end_right(); ++it, ++rit) {
+      EXPECT_EQ(*rit, *it);
+      EXPECT_EQ(*rit.flip(), *it.flip());
+    }
+  }
+}
+
+TEST(bimap_randomized, diff) {
+  std::cout << "Seed used for randomized diff test is " << seed << std::endl;
+  using change_t = std::tuple<bimap<int, int>::change_kind, int, int>;
+
+  std::mt19937 e(seed);
+  persistent_bimap<int, int> p;
+  bimap<int, int> b;
+  for (size_t round = 0; round < 40; round++) {
+    auto p_old = p.snapshot();
+    bimap<int, int> b_old = b;
+    size_t changes_count = round % 2 == 0 ? e() % 10 : e() % 2000;
+    for (size_t i = 0; i < changes_count; i++) {
+      int left = e() % 5000, right = e() % 5000;
+      if (e() % 3 != 0) {
+        p.insert(left, right);
+        b.insert(left, right);
+      } else {
+        p.erase_left(left);
+        b.erase_left(left);
+      }
+    }
+
+    std::vector<change_t> changes, p_changes;
+    auto collect = [](std::vector<change_t> &to) {
+      return [&to](auto kind, int left, int right) { to.emplace_back(kind, left, right); };
+    };
+    diff(b_old, b, collect(changes));
+    diff(p_old, p, collect(p_changes));
+    EXPECT_EQ(changes, p_changes);
+
+    bimap<int, int> applied = b_old;
+    for (auto const &[kind, left, right] : changes) {
+      if (kind != bimap<int, int>::change_kind::inserted) {
+        EXPECT_TRUE(applied.erase_left(left));
+      }
+    }
+    for (auto const &[kind, left, right] : changes) {
+      if (kind != bimap<int, int>::change_kind::removed) {
+        EXPECT_NE(applied.insert(left, right), applied.end_left());
+      }
+    }
+    EXPECT_TRUE(applied == b);
+  }
+}
+
+TEST(bimap_randomized, node_handles) {
+  std::cout << "Seed used for randomized node handle test is " << seed << std::endl;
+
+  bimap<int, int> b, spare;
+  std::map<int, int> left_view, right_view, spare_left, spare_right;
+
+  auto check = [](bimap<int, int> const& b, std::map<int, int> const& left_view,
+                  std::map<int, int> const& right_view) {
+    ASSERT_EQ(b.size(), left_view.size());
+    ASSERT_EQ(b.size(), right_view.size());
+    auto lit = b.begin_left();
+    for (auto const& pair : left_view) {
+      EXPECT_EQ(*lit, pair.first);
+      EXPECT_EQ(*lit.flip(), pair.second);
+      ++lit;
+    }
+    auto rit = b.begin_right();
+    for (auto const& pair : right_view) {
+      EXPECT_EQ(*rit, pair.first);
+      ++rit;
+    }
+  };
+
+  std::mt19937 e(seed);
+  size_t total = 40000;
+  for (size_t i = 0; i < total; i++) {
+    unsigned int op = e() % 10;
+    int l = e() % 4000, r = e() % 4000;
+    if (op < 4) {
+      if (b.insert(l, r) != b.end_left()) {
+        left_view.emplace(l, r);
+        right_view.emplace(r, l);
+      }
+    } else if (b.empty()) {
+      continue;
+    } else if (op < 6) {
+      auto it = b.nth_left(e() % b.size());
+      int old = *it, right = *it.flip();
+      if (b.replace_left(it, l) == b.end_left()) {
+        EXPECT_TRUE(left_view.count(l) != 0 && l != old);
+        EXPECT_EQ(*it, old);
+      } else {
+        EXPECT_EQ(*it, l);
+        left_view.erase(old);
+        left_view.emplace(l, right);
+        right_view[right] = l;
+      }
+    } else if (op < 8) {
+      auto it = b.nth_right(e() % b.size());
+      int old = *it, left = *it.flip();
+      if (b.replace_right(it, r) == b.end_right()) {
+        EXPECT_TRUE(right_view.count(r) != 0 && r != old);
+      } else {
+        right_view.erase(old);
+        right_view.emplace(r, left);
+        left_view[left] = r;
+      }
+    } else if (op < 9) {
+      auto node = b.extract_left(b.nth_left(e() % b.size()));
+      left_view.erase(node.left());
+      right_view.erase(node.right());
+      node.left() = l;
+      bool inserted = spare.insert(std::move(node)) != spare.end_left();
+      EXPECT_EQ(inserted, node.empty());
+      if (inserted) {
+        spare_left.emplace(l, spare.at_left(l));
+        spare_right.emplace(spare.at_left(l), l);
+      }
+    } else {
+      b.merge(spare);
+      for (auto it = spare_left.begin(); it != spare_left.end();) {
+        if (left_view.count(it->first) == 0 && right_view.count(it->second) == 0) {
+          left_view.insert(*it);
+          right_view.emplace(it->second, it->first);
+          spare_right.erase(it->second);
+          it = spare_left.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+    if (i % 100 == 0) {
+      check(b, left_view, right_view);
+      check(spare, spare_left, spare_right);
+    }
+  }
+  check(b, left_view, right_view);
+  check(spare, spare_left, spare_right);
+}
+
+
+TEST(bimap_randomized, insert_comparisons) {
+  bimap<uint32_t, uint32_t, counting_less, counting_less> b;
+  std::mt19937 e(seed);
+  std::vector<std::pair<uint32_t, uint32_t>> pairs;
+  for (size_t i = 0; i < 100000; i++) {
+    pairs.emplace_back(e(), e());
+  }
+
+  counting_less::calls = 0;
+  for (auto const &p : pairs) {
+    b.insert(p.first, p.second);
+  }
+  size_t insert_calls = counting_less::calls;
+
+  counting_less::calls = 0;
+  for (auto const &p : pairs) {
+    b.find_left(p.first);
+    b.find_right(p.second);
+  }
+  size_t find_calls = counting_less::calls;
+
+  std::cout << "Comparator calls per pair: " << double(insert_calls) / pairs.size()
+            << " by insert, " << double(find_calls) / pairs.size() << " by find_left and find_right"
+            << std::endl;
+  EXPECT_LE(insert_calls, find_calls);
+}
+
+TEST(bimap_randomized, insert_hint_sorted) {
+  bimap<uint32_t, uint32_t, counting_less> b;
+  uint32_t total = 100000;
+
+  counting_less::calls = 0;
+  auto hint = b.end_left();
+  for (uint32_t i = 0; i < total; i++) {
+    auto it = b.insert(hint, i * 2, i);
+    hint = it == b.end_left() ? hint : it;
+  }
+  size_t calls_by_hint = counting_less::calls;
+  for (uint32_t i = total; i > 0; i--) {
+    b.insert(b.end_left(), i * 2 - 1, total + i);
+  }
+
+  std::cout << "Left comparator calls per sorted insert with a hint: "
+            << double(calls_by_hint) / total << std::endl;
+  EXPECT_LE(calls_by_hint, 2 * total);
+  uint32_t expected = 0;
+  for (auto it = b.begin_left(); it != b.end_left(); it++) {
+    EXPECT_EQ(*it, expected++);
+  }
+  EXPECT_EQ(b.size(), expected);
+}
+
+TEST(bimap_randomized, insert_range) {
+  std::cout << "Seed used for randomized range insert test is " << seed << std::endl;
+
+  std::mt19937 e(seed);
+  bimap<int, int> b, expected;
+  for (size_t round = 0; round < 20; round++) {
+    std::vector<std::pair<int, int>> pairs(round % 2 == 0 ? 3000 : 50);
+    for (auto &p : pairs) {
+      p = {e() % 20000, e() % 20000};
+    }
+    b.insert(pairs.begin(), pairs.end());
+    for (auto const &p : pairs) {
+      expected.insert(p.first, p.second);
+    }
+    EXPECT_EQ(b, expected);
+  }
+
+  int previous = *b.begin_right();
+  for (auto it = ++b.begin_right(); it != b.end_right(); it++) {
+    EXPECT_GT(*it, previous);
+    EXPECT_EQ(*expected.find_left(*it.flip()).flip(), *it);
+    previous = *it;
+  }
+}
+
+TEST(bimap_randomized, insert_stream) {
+  std::cout << "Seed used for randomized stream insert test is " << seed << std::endl;
+
+  std::mt19937 e(seed);
+  bimap<int, int> b, expected;
+  for (size_t round = 0; round < 20; round++) {
+    std::vector<std::pair<int, int>> pairs(e() % 5000);
+    for (auto &p : pairs) {
+      p = {e() % 20000, e() % 20000};
+    }
+    if (round % 2 == 0) {
+      std::sort(pairs.begin(), pairs.end());
+    }
+    b.insert_stream(pairs.begin(), pairs.end(), 1 + e() % 1000);
+    for (auto const &p : pairs) {
+      expected.insert(p.first, p.second);
+    }
+    ASSERT_EQ(b, expected);
+  }
+  std::cout << "Final size " << b.size() << std::endl;
+}
+
+TEST(bimap_randomized, copy) {
+  std::cout << "Seed used for randomized copy test is " << seed << std::endl;
+
+  bimap<int, int, std::greater<>> b;
+  std::mt19937 e(seed);
+  for (size_t i = 0; i < 20000; i++) {
+    b.insert(e(), e());
+  }
+
+  bimap<int, int, std::greater<>> copy(b);
+  EXPECT_EQ(copy.size(), b.size());
+  EXPECT_EQ(copy, b);
+  for (auto it = b.begin_right(); it != b.end_right(); it++) {
+    EXPECT_EQ(*copy.find_right(*it).flip(), *it.flip());
+  }
+
+  for (size_t i = 0; i < 10000; i++) {
+    copy.erase_left(copy.begin_left());
+    copy.insert(e(), e());
+  }
+  copy.erase_left(copy.begin_left(), copy.end_left());
+  EXPECT_EQ(b.size(), 20000);
+}
+
+template <typename Left, typename Right, typename CompareLeft, typename CompareRight = std::less<Right>>
+static void check_freeze(std::mt19937 &e, uint64_t range) {
+  for (size_t total : {1, 2, 7, 16, 17, 1000, 30000}) {
+    bimap<Left, Right, CompareLeft, CompareRight> b;
+    for (size_t i = 0; i < total; i++) {
+      b.insert(Left(e() % range), Right(e() % range));
+    }
+    auto f = b.freeze();
+    for (size_t i = 0; i < 3000; i++) {
+      Left left = Left(e() % range);
+      Right right = Right(e() % range);
+      EXPECT_EQ(f.find_left(left), b.find_left(left));
+      EXPECT_EQ(f.lower_bound_left(left), b.lower_bound_left(left));
+      EXPECT_EQ(f.upper_bound_left(left), b.upper_bound_left(left));
+      EXPECT_EQ(f.find_right(right), b.find_right(right));
+      EXPECT_EQ(f.lower_bound_right(right), b.lower_bound_right(right));
+      EXPECT_EQ(f.upper_bound_right(right), b.upper_bound_right(right));
+    }
+  }
+}
+
+TEST(bimap_randomized, freeze) {
+  std::cout << "Seed used for randomized freeze test is " << seed << std::endl;
+
+  std::mt19937 e(seed);
+  check_freeze<uint32_t, uint32_t, std::less<uint32_t>>(e, 100000);
+  check_freeze<uint32_t, uint64_t, std::greater<>, std::greater<uint64_t>>(e, uint64_t(-1));
+  check_freeze<int64_t, int32_t, std::less<>, std::greater<int32_t>>(e, uint64_t(-1));
+  check_freeze<uint8_t, int16_t, std::greater<uint8_t>>(e, 1000);
+  check_freeze<double, int, std::greater<double>>(e, 100000);
+
+  bimap<int32_t, uint64_t, std::less<>> b;
+  b.insert(std::numeric_limits<int32_t>::max(), std::numeric_limits<uint64_t>::max());
+  b.insert(std::numeric_limits<int32_t>::min(), 0);
+  auto f = b.freeze();
+  EXPECT_EQ(f.upper_bound_left(std::numeric_limits<int32_t>::max()), b.end_left());
+  EXPECT_EQ(*f.find_left(std::numeric_limits<int32_t>::max()).flip(),
+            std::numeric_limits<uint64_t>::max());
+  EXPECT_EQ(f.lower_bound_left(int64_t(1) << 40), b.end_left());
+  EXPECT_EQ(*f.upper_bound_left(-(int64_t(1) << 40)), std::numeric_limits<int32_t>::min());
+  EXPECT_EQ(*f.find_right(std::numeric_limits<uint64_t>::max()).flip(), std::numeric_limits<int32_t>::max());
+}
+
+TEST(bimap_randomized, find_batch) {
+  std::cout << "Seed used for randomized batch lookup test is " << seed << std::endl;
+
+  std::mt19937 e(seed);
+  bimap<uint32_t, uint32_t> b;
+  for (size_t i = 0; i < 20000; i++) {
+    b.insert(e() % 50000, e() % 50000);
+  }
+  for (size_t count : {0, 1, 15, 16, 17, 1000}) {
+    std::vector<uint32_t> keys(count);
+    for (auto &key : keys) {
+      key = e() % 50000;
+    }
+    std::vector<bimap<uint32_t, uint32_t>::right_iterator> found(count);
+    EXPECT_EQ(b.find_right_batch(keys.begin(), keys.end(), found.begin()), found.end());
+    for (size_t i = 0; i < count; i++) {
+      EXPECT_EQ(found[i], b.find_right(keys[i]));
+    }
+  }
+}
+
+TEST(concurrent_bimap_randomized, readers_and_writer) {
+  std::cout << "Seed used for randomized concurrent test is " << seed << std::endl;
+
+  concurrent_bimap<uint32_t, uint32_t> b;
+  std::atomic<bool> done{false};
+  std::atomic<size_t> inconsistent{0}, found{0};
+  std::vector<std::thread> readers;
+  for (uint32_t t = 0; t < 3; t++) {
+    readers.emplace_back([&, t] {
+      std::mt19937 e(seed + t);
+      while (!done.load()) {
+        uint32_t key = e() % 1000;
+        bool consistent = b.read([key, &found](auto const &m) {
+          auto it = m.find_left(key);
+          if (it == m.end_left()) {
+            return m.find_right(key * 2 + 1) == m.end_right();
+          }
+          found++;
+          return *it.flip() == key * 2 + 1 && m.find_right(key * 2 + 1).flip() == it;
+        });
+        inconsistent += !consistent;
+      }
+    });
+  }
+
+  std::mt19937 e(seed);
+  for (size_t i = 0; i < 5000; i++) {
+    uint32_t key = e() % 1000;
+    if (e() % 2 == 0) {
+      b.insert(key, key * 2 + 1);
+    } else {
+      b.erase_right(key * 2 + 1);
+    }
+  }
+  done = true;
+  for (auto &reader : readers) {
+    reader.join();
+  }
+  std::cout << "Readers found " << found << " pairs" << std::endl;
+  EXPECT_EQ(inconsistent, 0);
+}
+
+TEST(sharded_bimap_randomized, concurrent_writers) {
+  std::cout << "Seed used for randomized sharded test is " << seed << std::endl;
+
+  uint32_t range = 2000;
+  sharded_bimap<uint32_t, uint32_t> b(16);
+  std::vector<std::thread> writers;
+  for (uint32_t t = 0; t < 4; t++) {
+    writers.emplace_back([&, t] {
+      std::mt19937 e(seed + t);
+      for (size_t i = 0; i < 20000; i++) {
+        unsigned op = e() % 4;
+        if (op < 2) {
+          b.insert(e() % range, e() % range);
+        } else if (op == 2) {
+          b.erase_left(e() % range);
+        } else {
+          b.erase_right(e() % range);
+        }
+      }
+    });
+  }
+  for (auto &writer : writers) {
+    writer.join();
+  }
+
+  size_t lefts = 0, rights = 0;
+  for (uint32_t key = 0; key < range; key++) {
+    if (auto right = b.find_left(key)) {
+      lefts++;
+      EXPECT_EQ(b.find_right(*right), key);
+    }
+    if (auto left = b.find_right(key)) {
+      rights++;
+      EXPECT_EQ(b.find_left(*left), key);
+    }
+  }
+  std::cout << "Sharded bimap holds " << b.size() << " pairs" << std::endl;
+  EXPECT_EQ(lefts, b.size());
+  EXPECT_EQ(rights, b.size());
+}
+
+TEST(persistent_bimap_randomized, snapshots) {
+  std::cout << "Seed used for randomized persistent test is " << seed << std::endl;
+
+  std::mt19937 e(seed);
+  persistent_bimap<int, int> b;
+  bimap<int, int> expected;
+  std::vector<std::pair<persistent_bimap<int, int>, bimap<int, int>>> versions;
+  for (size_t i = 0; i < 20000; i++) {
+    int left = e() % 5000, right = e() % 5000;
+    if (e() % 3 != 0) {
+      EXPECT_EQ(b.insert(left, right) == b.end_left(), expected.insert(left, right) == expected.end_left());
+    } else if (e() % 2 == 0) {
+      EXPECT_EQ(b.erase_left(left), expected.erase_left(left));
+    } else {
+      EXPECT_EQ(b.erase_right(right), expected.erase_right(right));
+    }
+    if (i % 2000 == 0) {
+      versions.emplace_back(b.snapshot(), expected);
+    }
+  }
+  versions.emplace_back(b.snapshot(), expected);
+
+  for (auto const &[snapshot, copy] : versions) {
+    ASSERT_EQ(snapshot.size(), copy.size());
+    auto it = copy.begin_left();
+    for (auto p = snapshot.begin_left(); p != snapshot.end_left(); ++p, ++it) {
+      EXPECT_EQ(*p, *it);
+      EXPECT_EQ(*p.flip(), *it.flip());
+    }
+    auto rit = copy.end_right();
+    for (auto p = snapshot.end_right(); p != snapshot.begin_right();) {
+      EXPECT_EQ(*--p, *--rit);
+    }
+  }
+}
+
+TEST(bimap_randomized, save_load) {
+  std::cout << "Seed used for randomized save test is " << seed << std::endl;
+
+  std::mt19937 e(seed);
+  for (size_t round = 0; round < 10; round++) {
+    bimap<uint32_t, uint64_t> b;
+    size_t count = e() % 5000;
+    while (b.size() < count) {
+      b.insert(e() % 10000, e() % 10000);
+    }
+    std::stringstream stream;
+    b.save(stream);
+    std::string data = stream.str();
+    ASSERT_EQ((bimap<uint32_t, uint64_t>::load(stream)), b);
+
+    std::vector<uint64_t> buffer(data.size() / sizeof(uint64_t) + 1);
+    std::memcpy(buffer.data(), data.data(), data.size());
+    mapped_bimap<uint32_t, uint64_t> m(buffer.data(), data.size());
+    ASSERT_EQ(m.size(), b.size());
+    for (size_t i = 0; i < 1000; i++) {
+      uint32_t left = e() % 10000;
+      uint64_t right = e() % 10000;
+      auto it = b.lower_bound_left(left);
+      auto mit = m.lower_bound_left(left);
+      EXPECT_EQ(it == b.end_left(), mit == m.end_left());
+      if (it != b.end_left()) {
+        EXPECT_EQ(*mit, *it);
+        EXPECT_EQ(*mit.flip(), *it.flip());
+      }
+      auto rit = b.upper_bound_right(right);
+      auto mrit = m.upper_bound_right(right);
+      EXPECT_EQ(rit == b.end_right(), mrit == m.end_right());
+      if (rit != b.end_right()) {
+        EXPECT_EQ(*mrit, *rit);
+        EXPECT_EQ(*mrit.flip(), *rit.flip());
+      }
+    }
+  }
+}
+
+TEST(unordered_bimap_randomized, compare_to_bimap) {
+  std::cout << "Seed used for randomized unordered_bimap test is " << seed << std::endl;
+
+  std::mt19937 e(seed);
+  unordered_bimap<int, int> u;
+  bimap<int, int> b;
+  for (size_t i = 0; i < 50000; i++) {
+    int left = e() % 5000, right = e() % 5000;
+    unsigned op = e() % 4;
+    if (op < 2) {
+      EXPECT_EQ(u.insert(left, right) == u.end_left(), b.insert(left, right) == b.end_left());
+    } else if (op == 2) {
+      EXPECT_EQ(u.erase_left(left), b.erase_left(left));
+    } else {
+      EXPECT_EQ(u.erase_right(right), b.erase_right(right));
+    }
+    auto it = u.find_left(left);
+    auto bit = b.find_left(left);
+    ASSERT_EQ(it == u.end_left(), bit == b.end_left());
+    if (it != u.end_left()) {
+      EXPECT_EQ(*it.flip(), *bit.flip());
+    }
+  }
+
+  ASSERT_EQ(u.size(), b.size());
+  std::vector<std::pair<int, int>> pairs;
+  for (auto it = u.begin_right(); it != u.end_right(); it++) {
+    pairs.emplace_back(*it.flip(), *it);
+  }
+  std::sort(pairs.begin(), pairs.end());
+  auto bit = b.begin_left();
+  for (auto const &p : pairs) {
+    EXPECT_EQ(p.first, *bit);
+    EXPECT_EQ(p.second, *bit.flip());
+    bit++;
+  }
+  EXPECT_EQ(u, (unordered_bimap<int, int>(pairs.begin(), pairs.end())));
+  std::cout << "Final size " << u.size() << std::endl;
+}
+
+template <typename Bimap>
+static void check_indexed(std::mt19937 &e) {
+  Bimap x;
+  bimap<int, int> b;
+  for (size_t i = 0; i < 20000; i++) {
+    int left = e() % 3000, right = e() % 3000;
+    unsigned op = e() % 4;
+    if (op < 2) {
+      EXPECT_EQ(x.insert(left, right) == x.end_left(), b.insert(left, right) == b.end_left());
+    } else if (op == 2) {
+      EXPECT_EQ(x.erase_left(left), b.erase_left(left));
+    } else {
+      EXPECT_EQ(x.erase_right(right), b.erase_right(right));
+    }
+    auto it = x.find_right(right);
+    auto bit = b.find_right(right);
+    ASSERT_EQ(it == x.end_right(), bit == b.end_right());
+    if (it != x.end_right()) {
+      EXPECT_EQ(*it.flip(), *bit.flip());
+    }
+  }
+  ASSERT_EQ(x.size(), b.size());
+  size_t count = 0;
+  for (auto it = x.begin_left(); it != x.end_left(); it++, count++) {
+    EXPECT_EQ(b.at_left(*it), *it.flip());
+  }
+  EXPECT_EQ(count, b.size());
+  EXPECT_EQ(Bimap(x), x);
+}
+
+TEST(indexed_bimap_randomized, compare_to_bimap) {
+  std::cout << "Seed used for randomized indexed_bimap test is " << seed << std::endl;
+
+  std::mt19937 e(seed);
+  check_indexed<indexed_bimap<int, int>>(e);
+  check_indexed<indexed_bimap<int, int, ordered_index<>, hashed_index<>>>(e);
+  check_indexed<indexed_bimap<int, int, hashed_index<>, ordered_index<>>>(e);
+  check_indexed<indexed_bimap<int, int, hashed_index<>, hashed_index<>>>(e);
+}
+
+TEST(flat_bimap_randomized, compare_to_bimap) {
+  std::cout << "Seed used for randomized flat_bimap test is " << seed << std::endl;
+
+  std::mt19937 e(seed);
+  flat_bimap<int, int> f;
+  bimap<int, int> b;
+  for (size_t round = 0; round < 200; round++) {
+    unsigned op = e() % 4;
+    if (op == 0) {
+      std::vector<std::pair<int, int>> pairs(e() % 500);
+      for (auto &p : pairs) {
+        p = {e() % 5000, e() % 5000};
+      }
+      f.insert(pairs.begin(), pairs.end());
+      b.insert(pairs.begin(), pairs.end());
+    } else if (op == 1) {
+      int l = e() % 5000, r = e() % 5000;
+      bool inserted = b.insert(l, r) != b.end_left();
+      auto it = f.insert(l, r);
+      EXPECT_EQ(it != f.end_left(), inserted);
+    } else if (op == 2) {
+      int l = e() % 5000, r = l + e() % 200;
+      f.erase_left(f.lower_bound_left(l), f.upper_bound_left(r));
+      b.erase_left(b.lower_bound_left(l), b.upper_bound_left(r));
+    } else {
+      int r = e() % 5000;
+      EXPECT_EQ(f.erase_right(r), b.erase_right(r));
+    }
+
+    ASSERT_EQ(f.size(), b.size());
+    auto bit = b.begin_left();
+    for (auto it = f.begin_left(); it != f.end_left(); it++, bit++) {
+      EXPECT_EQ(*it, *bit);
+      EXPECT_EQ(*it.flip(), *bit.flip());
+    }
+    auto brit = b.begin_right();
+    for (auto it = f.begin_right(); it != f.end_right(); it++, brit++) {
+      EXPECT_EQ(*it, *brit);
+      EXPECT_EQ(*it.flip(), *brit.flip());
+    }
+  }
+  std::cout << "Final size " << f.size() << std::endl;
+}
+
+#ifdef ENABLE_SLOW_TEST
+template <typename F>
+static double measure_seconds(F&& f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+TEST(bimap_performance, copy) {
+  bimap<uint32_t, uint32_t> b;
+  std::mt19937 e(seed);
+  while (b.size() < 1000000) {
+    b.insert(e(), e());
+  }
+
+  double by_insert = measure_seconds([&] {
+    bimap<uint32_t, uint32_t> copy;
+    for (auto it = b.begin_left(); it != b.end_left(); it++) {
+      copy.insert(*it, *it.flip());
+    }
+  });
+  double by_copy = measure_seconds([&] {
+    bimap<uint32_t, uint32_t> copy(b);
+  });
+  std::cout << "Copy of " << b.size() << " pairs: " << by_insert << "s by insert, "
+            << by_copy << "s by copy constructor" << std::endl;
+  EXPECT_LT(by_copy, by_insert);
+}
+
+TEST(bimap_performance, destroy) {
+  std::mt19937 e(seed);
+  bimap<uint32_t, uint32_t> b;
+  while (b.size() < 1000000) {
+    b.insert(e(), e());
+  }
+  bimap<uint32_t, uint32_t> copy(b);
+
+  double by_erase = measure_seconds([&] {
+    b.erase_left(b.begin_left(), b.end_left());
+  });
+  double by_clear = measure_seconds([&] {
+    copy.clear();
+  });
+  std::cout << "Destruction of 1000000 pairs: " << by_erase << "s by erase, "
+            << by_clear << "s by clear" << std::endl;
+  EXPECT_LT(by_clear, by_erase);
+}
+
+template <typename Bimap>
+static double insert_erase_seconds(Bimap& b) {
+  std::mt19937 e(seed);
+  return measure_seconds([&] {
+    for (size_t i = 0; i < 1000000; i++) {
+      b.insert(e(), e());
+    }
+    for (size_t i = 0; i < 1000000; i++) {
+      auto it = b.lower_bound_left(e());
+      if (it != b.end_left()) {
+        b.erase_left(it);
+      }
+      b.insert(e(), e());
+    }
+    b.clear();
+  });
+}
+
+TEST(bimap_performance, insert_range) {
+  for (size_t total : {1000000, 4000000}) {
+    std::mt19937 e(seed);
+    std::vector<std::pair<uint32_t, uint32_t>> pairs(total);
+    for (auto &p : pairs) {
+      p = {e(), e()};
+    }
+
+    double by_insert = measure_seconds([&] {
+      bimap<uint32_t, uint32_t> b;
+      for (auto const &p : pairs) {
+        b.insert(p.first, p.second);
+      }
+    });
+    double by_range = measure_seconds([&] {
+      bimap<uint32_t, uint32_t> b(pairs.begin(), pairs.end());
+    });
+    std::cout << "Construction of " << total << " pairs: " << by_insert << "s by insert, "
+              << by_range << "s by range" << std::endl;
+    EXPECT_LT(by_range, by_insert);
+  }
+}
+
+template <typename Left, typename Right, typename Generate>
+static void report_memory(char const *name, Generate generate) {
+  using allocator_t = counting_allocator<std::pair<Left, Right>>;
+  size_t allocated = 0;
+  bimap<Left, Right, std::less<>, std::less<>, allocator_t> b((allocator_t(&allocated)));
+  std::mt19937 e(seed);
+  while (b.size() < 1000000) {
+    b.insert(generate(e), e());
+  }
+  size_t bytes = allocated * sizeof(bimap_impl::bimap_node<Left, Right>);
+  std::cout << "bimap<" << name << "> with " << b.size() << " pairs: " << bytes / (1 << 20)
+            << " MiB of nodes, " << bytes / b.size() << " bytes per pair, "
+            << bytes / b.size() - sizeof(Left) - sizeof(Right) << " of them overhead" << std::endl;
+}
+
+TEST(bimap_performance, insert_stream) {
+  size_t total = 4000000;
+  std::mt19937 e(seed);
+  std::stringstream dump;
+  for (uint32_t left = 0; left < total; left++) {
+    dump << left * 3 << ' ' << e() << '\n';
+  }
+  std::string text = dump.str();
+
+  double by_range = measure_seconds([&] {
+    std::istringstream in(text);
+    std::vector<std::pair<uint32_t, uint32_t>> pairs;
+    uint32_t left, right;
+    while (in >> left >> right) {
+      pairs.emplace_back(left, right);
+    }
+    bimap<uint32_t, uint32_t> b(pairs.begin(), pairs.end());
+  });
+  double by_stream = measure_seconds([&] {
+    std::istringstream in(text);
+    bimap<uint32_t, uint32_t> b;
+    b.insert_stream(in);
+  });
+  std::cout << "Loading " << total << " pairs sorted by left: " << by_range
+            << "s by reading a vector and inserting the range, " << by_stream
+            << "s by insert_stream in chunks of 4096" << std::endl;
+}
+
+TEST(bimap_performance, set_operations) {
+  size_t total = 2000000;
+  std::mt19937 e(seed);
+  bimap<uint32_t, uint32_t> yesterday, today;
+  for (size_t i = 0; i < total; i++) {
+    uint32_t left = e(), right = e();
+    yesterday.insert(left, right);
+    today.insert(e() % 100 == 0 ? e() : left, e() % 100 == 0 ? e() : right);
+  }
+
+  bimap<uint32_t, uint32_t> by_lookups = yesterday, by_walk = yesterday;
+  double united_by_lookups = measure_seconds([&] {
+    for (auto it = today.begin_left(); it != today.end_left(); ++it) {
+      if (by_lookups.find_left(*it) == by_lookups.end_left() &&
+          by_lookups.find_right(*it.flip()) == by_lookups.end_right()) {
+        by_lookups.insert(*it, *it.flip());
+      }
+    }
+  });
+  double united_by_walk = measure_seconds([&] {
+    by_walk.unite(today);
+  });
+  EXPECT_TRUE(by_lookups == by_walk);
+
+  by_lookups = yesterday;
+  by_walk = yesterday;
+  double subtracted_by_lookups = measure_seconds([&] {
+    for (auto it = today.begin_left(); it != today.end_left(); ++it) {
+      auto found = by_lookups.find_left(*it);
+      if (found != by_lookups.end_left() && *found.flip() == *it.flip()) {
+        by_lookups.erase_left(found);
+      }
+    }
+  });
+  double subtracted_by_walk = measure_seconds([&] {
+    by_walk.subtract(today);
+  });
+  EXPECT_TRUE(by_lookups == by_walk);
+  std::cout << "Reconciling two bimaps of " << total << " pairs: union " << united_by_lookups
+            << "s by lookups, " << united_by_walk << "s by unite; difference " << subtracted_by_lookups
+            << "s by lookups, " << subtracted_by_walk << "s by subtract" << std::endl;
+}
+
+TEST(bimap_performance, rekey) {
+  size_t total = 1000000;
+  std::mt19937 e(seed);
+  bimap<uint32_t, std::string> original;
+  for (uint32_t left = 0; left < total; left++) {
+    original.insert(left, std::string(24, 'x') + std::to_string(left));
+  }
+  std::vector<uint32_t> order(total);
+  std::iota(order.begin(), order.end(), 0);
+  std::shuffle(order.begin(), order.end(), e);
+
+  bimap<uint32_t, std::string> b = original;
+  double by_insert = measure_seconds([&] {
+    for (uint32_t left : order) {
+      auto it = b.find_left(left);
+      std::string right = *it.flip();
+      b.erase_left(it);
+      b.insert(left + total, std::move(right));
+    }
+  });
+  bimap<uint32_t, std::string> b1 = original;
+  double by_replace = measure_seconds([&] {
+    for (uint32_t left : order) {
+      b1.replace_left(b1.find_left(left), left + total);
+    }
+  });
+  EXPECT_TRUE(b == b1);
+  std::cout << "Re-keying " << total << " pairs: " << by_insert << "s by erase and insert, "
+            << by_replace << "s by replace_left" << std::endl;
+}
+
+TEST(bimap_performance, node_memory) {
+  report_memory<int, int>("int, int", [](std::mt19937 &e) { return int(e()); });
+  report_memory<std::string, uint64_t>("std::string, uint64_t", [](std::mt19937 &e) {
+    return std::to_string(e());
+  });
+}
+
+TEST(bimap_performance, pool_allocator) {
+  bimap<uint32_t, uint32_t> std_b;
+  bimap<uint32_t, uint32_t, std::less<>, std::less<>, pool_allocator<std::pair<uint32_t, uint32_t>>> pool_b;
+  double by_std = insert_erase_seconds(std_b);
+  double by_pool = insert_erase_seconds(pool_b);
+  std::cout << "Insert/erase of 1000000 pairs: " << by_std << "s with std::allocator, "
+            << by_pool << "s with pool_allocator" << std::endl;
+}
+
+struct plain_less {
+  bool operator()(uint32_t a, uint32_t b) const {
+    return a < b;
+  }
+};
+
+template <typename Compare>
+static void measure_freeze(char const *name) {
+  size_t total = 10000000;
+  std::mt19937 e(seed);
+  std::vector<std::pair<uint32_t, uint32_t>> pairs(total);
+  for (auto &p : pairs) {
+    p = {e(), e()};
+  }
+  bimap<uint32_t, uint32_t, Compare> b(pairs.begin(), pairs.end());
+  std::vector<uint32_t> keys(total);
+  for (auto &key : keys) {
+    key = pairs[e() % total].first;
+  }
+
+  uint64_t by_tree_sum = 0, by_frozen_sum = 0;
+  double by_tree = measure_seconds([&] {
+    for (uint32_t key : keys) {
+      by_tree_sum += *b.lower_bound_left(key).flip();
+    }
+  });
+  double by_freeze = measure_seconds([&] { b.freeze(); });
+  auto f = b.freeze();
+  double by_frozen = measure_seconds([&] {
+    for (uint32_t key : keys) {
+      by_frozen_sum += *f.lower_bound_left(key).flip();
+    }
+  });
+  std::cout << total << " lookups among " << b.size() << " pairs with " << name << ": " << by_tree
+            << "s in the tree, " << by_frozen << "s in the frozen view, which took " << by_freeze
+            << "s to build" << std::endl;
+  EXPECT_EQ(by_tree_sum, by_frozen_sum);
+  EXPECT_LT(by_frozen, by_tree);
+}
+
+TEST(bimap_performance, freeze) {
+  measure_freeze<plain_less>("a custom comparator");
+  measure_freeze<std::less<uint32_t>>("std::less");
+}
+
+TEST(bimap_performance, find_batch) {
+  size_t total = 4000000;
+  std::mt19937 e(seed);
+  std::vector<std::pair<uint32_t, uint32_t>> pairs(total);
+  for (auto &p : pairs) {
+    p = {e(), e()};
+  }
+  bimap<uint32_t, uint32_t> b(pairs.begin(), pairs.end());
+  std::vector<uint32_t> keys(total);
+  for (auto &key : keys) {
+    key = pairs[e() % total].first;
+  }
+
+  size_t batch = 256;
+  uint64_t by_find_sum = 0, by_batch_sum = 0;
+  double by_find = measure_seconds([&] {
+    for (uint32_t key : keys) {
+      by_find_sum += *b.find_left(key);
+    }
+  });
+  std::vector<bimap<uint32_t, uint32_t>::left_iterator> found(batch);
+  double by_batch = measure_seconds([&] {
+    for (size_t i = 0; i < total; i += batch) {
+      auto last = b.find_left_batch(keys.begin() + i, keys.begin() + std::min(i + batch, total), found.begin());
+      for (auto it = found.begin(); it != last; it++) {
+        by_batch_sum += **it;
+      }
+    }
+  });
+  std::cout << total << " lookups among " << b.size() << " pairs: " << by_find << "s by find_left, "
+            << by_batch << "s by find_left_batch in batches of " << batch << std::endl;
+  EXPECT_EQ(by_find_sum, by_batch_sum);
+  EXPECT_LT(by_batch, by_find);
+}
+
+TEST(bimap_performance, unordered) {
+  size_t total = 4000000;
+  std::mt19937 e(seed);
+  std::vector<std::pair<uint32_t, uint32_t>> pairs(total);
+  for (auto &p : pairs) {
+    p = {e(), e()};
+  }
+
+  bimap<uint32_t, uint32_t> b;
+  unordered_bimap<uint32_t, uint32_t> u;
+  double by_tree_insert = measure_seconds([&] {
+    for (auto const &p : pairs) {
+      b.insert(p.first, p.second);
+    }
+  });
+  double by_hash_insert = measure_seconds([&] {
+    for (auto const &p : pairs) {
+      u.insert(p.first, p.second);
+    }
+  });
+  ASSERT_EQ(b.size(), u.size());
+  std::vector<uint32_t> keys(total);
+  for (auto &key : keys) {
+    key = *b.nth_right(e() % b.size());
+  }
+
+  uint64_t by_tree_sum = 0, by_hash_sum = 0;
+  double by_tree_find = measure_seconds([&] {
+    for (uint32_t key : keys) {
+      by_tree_sum += *b.find_right(key).flip();
+    }
+  });
+  double by_hash_find = measure_seconds([&] {
+    for (uint32_t key : keys) {
+      by_hash_sum += *u.find_right(key).flip();
+    }
+  });
+  std::cout << total << " inserts: " << by_tree_insert << "s into bimap, " << by_hash_insert
+            << "s into unordered_bimap" << std::endl;
+  std::cout << total << " lookups: " << by_tree_find << "s in bimap, " << by_hash_find
+            << "s in unordered_bimap" << std::endl;
+  EXPECT_EQ(by_tree_sum, by_hash_sum);
+  EXPECT_LT(by_hash_find, by_tree_find);
+}
+
+TEST(bimap_performance, hybrid) {
+  size_t total = 4000000;
+  std::mt19937 e(seed);
+  bimap<uint32_t, uint32_t> b;
+  indexed_bimap<uint32_t, uint32_t, ordered_index<>, hashed_index<>> h;
+  while (b.size() < total) {
+    uint32_t left = e(), right = e();
+    b.insert(left, right);
+    h.insert(left, right);
+  }
+  ASSERT_EQ(b.size(), h.size());
+  std::vector<uint32_t> keys(total);
+  for (auto &key : keys) {
+    key = *b.nth_right(e() % total);
+  }
+
+  uint64_t by_tree_sum = 0, by_hybrid_sum = 0;
+  double by_tree_find = measure_seconds([&] {
+    for (uint32_t key : keys) {
+      by_tree_sum += *b.find_right(key).flip();
+    }
+  });
+  double by_hybrid_find = measure_seconds([&] {
+    for (uint32_t key : keys) {
+      by_hybrid_sum += *h.find_right(key).flip();
+    }
+  });
+  double by_tree_scan = measure_seconds([&] {
+    for (auto it = b.lower_bound_left(1u << 30); it != b.upper_bound_left(1u << 31); ++it) {
+      by_tree_sum += *it.flip();
+    }
+  });
+  double by_hybrid_scan = measure_seconds([&] {
+    for (auto it = h.lower_bound_left(1u << 30); it != h.upper_bound_left(1u << 31); ++it) {
+      by_hybrid_sum += *it.flip();
+    }
+  });
+  std::cout << total << " right lookups: " << by_tree_find << "s in bimap, " << by_hybrid_find
+            << "s with a hashed right side" << std::endl;
+  std::cout << "Left range scan over a quarter of the pairs: " << by_tree_scan << "s in bimap, "
+            << by_hybrid_scan << "s with an ordered left side" << std::endl;
+  EXPECT_EQ(by_tree_sum, by_hybrid_sum);
+  EXPECT_LT(by_hybrid_find, by_tree_find);
+}
+
+template <typename Read, typename Write>
+static double lookups_per_second(size_t threads, Read read, Write write) {
+  size_t lookups = 1000000;
+  std::atomic<bool> done{false};
+  std::atomic<size_t> found{0};
+  std::thread writer([&] {
+    std::mt19937 e(seed);
+    while (!done.load()) {
+      write(e);
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  });
+  double seconds = measure_seconds([&] {
+    std::vector<std::thread> readers;
+    for (size_t t = 0; t < threads; t++) {
+      readers.emplace_back([&, t] {
+        std::mt19937 e(seed + t);
+        size_t hits = 0;
+        for (size_t i = 0; i < lookups; i++) {
+          hits += read(e);
+        }
+        found += hits;
+      });
+    }
+    for (auto &reader : readers) {
+      reader.join();
+    }
+  });
+  done = true;
+  writer.join();
+  EXPECT_GT(found, 0);
+  return threads * lookups / seconds;
+}
+
+TEST(bimap_performance, concurrent_reads) {
+  uint32_t range = 1000000;
+  concurrent_bimap<uint32_t, uint32_t> concurrent;
+  bimap<uint32_t, uint32_t> locked;
+  std::shared_mutex mutex;
+  std::mt19937 e(seed);
+  for (size_t i = 0; i < range / 2; i++) {
+    uint32_t key = e() % range;
+    concurrent.insert(key, key);
+    locked.insert(key, key);
+  }
+
+  for (size_t threads : {1, 2, 4, 8}) {
+    double by_concurrent = lookups_per_second(
+        threads, [&](std::mt19937 &e) { return concurrent.find_left(e() % range).has_value(); },
+        [&](std::mt19937 &e) {
+          uint32_t key = e() % range;
+          concurrent.erase_left(key);
+          concurrent.insert(key, key);
+        });
+    double by_lock = lookups_per_second(
+        threads,
+        [&](std::mt19937 &e) {
+          std::shared_lock<std::shared_mutex> lock(mutex);
+          return locked.find_left(e() % range) != locked.end_left();
+        },
+        [&](std::mt19937 &e) {
+          uint32_t key = e() % range;
+          std::unique_lock<std::shared_mutex> lock(mutex);
+          locked.erase_left(key);
+          locked.insert(key, key);
+        });
+    std::cout << threads << " reader threads next to a writer: " << by_concurrent / 1e6
+              << "M lookups/s in concurrent_bimap, " << by_lock / 1e6
+              << "M lookups/s in a bimap under std::shared_mutex" << std::endl;
+  }
+}
+
+template <typename Insert>
+static double inserts_per_second(size_t threads, Insert insert) {
+  size_t inserts = 200000;
+  return threads * inserts / measure_seconds([&] {
+    std::vector<std::thread> writers;
+    for (size_t t = 0; t < threads; t++) {
+      writers.emplace_back([&, t] {
+        std::mt19937 e(seed + t);
+        for (size_t i = 0; i < inserts; i++) {
+          insert(e(), e());
+        }
+      });
+    }
+    for (auto &writer : writers) {
+      writer.join();
+    }
+  });
+}
+
+TEST(bimap_performance, sharded_writes) {
+  for (size_t threads : {1, 2, 4, 8}) {
+    sharded_bimap<uint32_t, uint32_t> sharded(64);
+    double by_shards = inserts_per_second(threads, [&](uint32_t left, uint32_t right) {
+      sharded.insert(left, right);
+    });
+    bimap<uint32_t, uint32_t> locked;
+    std::mutex mutex;
+    double by_lock = inserts_per_second(threads, [&](uint32_t left, uint32_t right) {
+      std::lock_guard<std::mutex> lock(mutex);
+      locked.insert(left, right);
+    });
+    std::cout << threads << " writer threads: " << by_shards / 1e6 << "M inserts/s in sharded_bimap, "
+              << by_lock / 1e6 << "M inserts/s in a bimap under std::mutex" << std::endl;
+  }
+}
+
+TEST(bimap_performance, persistent_snapshot) {
+  size_t total = 1000000;
+  std::mt19937 e(seed);
+  bimap<uint32_t, uint32_t> b;
+  persistent_bimap<uint32_t, uint32_t> p;
+  double by_bimap = measure_seconds([&] {
+    while (b.size() < total) {
+      b.insert(e(), e());
+    }
+  });
+  double by_persistent = measure_seconds([&] {
+    while (p.size() < total) {
+      p.insert(e(), e());
+    }
+  });
+  double by_copy = measure_seconds([&] { bimap<uint32_t, uint32_t> copy(b); });
+  double by_snapshot = measure_seconds([&] { auto snapshot = p.snapshot(); });
+  std::cout << "Insertion of " << total << " pairs: " << by_bimap << "s into bimap, " << by_persistent
+            << "s into persistent_bimap" << std::endl;
+  std::cout << "Consistent view of " << total << " pairs: " << by_copy << "s by copying bimap, "
+            << by_snapshot << "s by persistent_bimap::snapshot" << std::endl;
+  EXPECT_LT(by_snapshot, by_copy);
+}
+
+TEST(bimap_performance, diff) {
+  size_t total = 1000000, changes = 1000;
+  std::mt19937 e(seed);
+  bimap<uint32_t, uint32_t> old_b;
+  persistent_bimap<uint32_t, uint32_t> old_p;
+  while (old_b.size() < total) {
+    uint32_t left = e(), right = e();
+    old_b.insert(left, right);
+    old_p.insert(left, right);
+  }
+  bimap<uint32_t, uint32_t> b = old_b;
+  persistent_bimap<uint32_t, uint32_t> p = old_p.snapshot();
+  for (size_t i = 0; i < changes; i++) {
+    uint32_t left = *old_b.nth_left(e() % total), right = e();
+    b.erase_left(left);
+    p.erase_left(left);
+    b.insert(left, right);
+    p.insert(left, right);
+  }
+
+  size_t by_lookups_count = 0, by_walk_count = 0, by_snapshot_count = 0;
+  double by_lookups = measure_seconds([&] {
+    for (auto it = old_b.begin_left(); it != old_b.end_left(); ++it) {
+      auto found = b.find_left(*it);
+      by_lookups_count += found == b.end_left() || *found.flip() != *it.flip();
+    }
+    for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+      by_lookups_count += old_b.find_left(*it) == old_b.end_left();
+    }
+  });
+  double by_walk = measure_seconds([&] {
+    diff(old_b, b, [&](auto, uint32_t, uint32_t) { by_walk_count++; });
+  });
+  double by_snapshot = measure_seconds([&] {
+    diff(old_p, p, [&](auto, uint32_t, uint32_t) { by_snapshot_count++; });
+  });
+  EXPECT_EQ(by_walk_count, by_lookups_count);
+  EXPECT_EQ(by_snapshot_count, by_lookups_count);
+  std::cout << "Diff of " << total << " pairs with " << by_walk_count << " changes: " << by_lookups
+            << "s by lookups, " << by_walk << "s by diff of bimap, " << by_snapshot
+            << "s by diff of persistent_bimap snapshots" << std::endl;
+}
+
+TEST(bimap_performance, load) {
+  size_t total = 4000000;
+  std::mt19937 e(seed);
+  std::vector<std::pair<uint32_t, uint32_t>> pairs;
+  bimap<uint32_t, uint32_t> b;
+  while (b.size() < total) {
+    uint32_t left = e(), right = e();
+    if (b.insert(left, right) != b.end_left()) {
+      pairs.emplace_back(left, right);
+    }
+  }
+  std::stringstream stream;
+  double by_save = measure_seconds([&] { b.save(stream); });
+  std::string data = stream.str();
+  std::vector<uint64_t> buffer(data.size() / sizeof(uint64_t) + 1);
+  std::memcpy(buffer.data(), data.data(), data.size());
+
+  double by_insert = measure_seconds([&] {
+    bimap<uint32_t, uint32_t> copy;
+    for (auto const &p : pairs) {
+      copy.insert(p.first, p.second);
+    }
+  });
+  double by_load = measure_seconds([&] { EXPECT_EQ((bimap<uint32_t, uint32_t>::load(stream).size()), total); });
+  double by_mapping = measure_seconds([&] {
+    mapped_bimap<uint32_t, uint32_t> m(buffer.data(), data.size());
+    EXPECT_EQ(m.size(), total);
+  });
+  std::cout << total << " pairs: " << by_save << "s to save, " << by_insert << "s to insert one by one, "
+            << by_load << "s to load, " << by_mapping << "s to map" << std::endl;
+  EXPECT_LT(by_load, by_insert);
+}
+#endif
@@ -4,7 +4,7 @@
 namespace bimap_impl {
 
 size_t tree_base_node::get_height(tree_base_node* point) noexcept {
-  return point != nullptr ? point->height : 0;
+  return point != nullptr ? point->load_height() : 0;
 }
 
 ptrdiff_t tree_base_node::get_balance() const noexcept {
@@ -12,7 +12,15 @@ ptrdiff_t tree_base_node::get_balance() const noexcept {
 }
 
 void tree_base_node::upd_height() noexcept {
-  height = std::max(get_height(left), get_height(right)) + 1;
+  store_height(std::max(get_height(left), get_height(right)) + 1);
+}
+
+size_t tree_base_node::get_size(tree_base_node* point) noexcept {
+  return point != nullptr ? point->size : 0;
+}
+
+void tree_base_node::upd_size() noexcept {
+  size = static_cast<decltype(size)>(get_size(left) + get_size(right) + 1);
 }
 
 void tree_base_node::upd_left() noexcept {
@@ -35,7 +43,9 @@ tree_base_node* tree_base_node::rotate_left() noexcept {
   p->left = this;
   p->upd_kids();
   upd_height();
+  upd_size();
   p->upd_height();
+  p->upd_size();
   return p;
 }
 
@@ -46,12 +56,15 @@ tree_base_node* tree_base_node::rotate_right() noexcept {
   v->right = this;
   v->upd_kids();
   upd_height();
+  upd_size();
   v->upd_height();
+  v->upd_size();
   return v;
 }
 
 tree_base_node* tree_base_node::balance() noexcept {
   upd_height();
+  upd_size();
   if (get_balance() == 2) {
     if (right->get_balance() < 0) {
       right = right->rotate_right();
@@ -77,13 +90,119 @@ tree_base_node* tree_base_node::get_min() const noexcept {
   return result;
 }
 
-tree_base_node* tree_base_node::remove_min(tree_base_node* point) noexcept {
-  if (point->left == nullptr) {
-    return point->right;
+void tree_base_node::link(insert_position const& position, tree_base_node* node) noexcept {
+  if (position.to_left) {
+    position.parent->left = node;
+  } else {
+    position.parent->right = node;
+  }
+  node->parent = position.parent;
+  rebalance(position.parent);
+}
+
+// The node is left as a new one, so it can be linked again, into this or
+// another tree.
+void tree_base_node::unlink(tree_base_node* node) noexcept {
+  tree_base_node* parent = node->parent;
+  if (node->right == nullptr) {
+    parent->replace_child(node, node->left);
+    rebalance(parent);
+    node->detach();
+    return;
+  }
+
+  tree_base_node* minimal = node->right->get_min();
+  tree_base_node* start = minimal;
+  if (minimal != node->right) {
+    start = minimal->parent;
+    start->left = minimal->right;
+    start->upd_left();
+    minimal->right = node->right;
+  }
+  minimal->left = node->left;
+  minimal->upd_kids();
+  minimal->store_height(node->load_height());
+  parent->replace_child(node, minimal);
+  rebalance(start);
+  node->detach();
+}
+
+void tree_base_node::detach() noexcept {
+  left = nullptr;
+  right = nullptr;
+  parent = nullptr;
+  store_height(1);
+  size = 1;
+}
+
+// Heights above a subtree that kept its height are unaffected, so rotations
+// stop there and only the subtree sizes are updated further up.
+void tree_base_node::rebalance(tree_base_node* point) noexcept {
+  while (!point->is_end()) {
+    size_t old_height = point->load_height();
+    tree_base_node* parent = point->parent;
+    tree_base_node* balanced = point->balance();
+    parent->replace_child(point, balanced);
+    point = parent;
+    if (balanced->load_height() == old_height) {
+      break;
+    }
+  }
+  for (; !point->is_end(); point = point->parent) {
+    point->upd_size();
+  }
+}
+
+tree_base_node* tree_base_node::select(tree_base_node* point, size_t index) noexcept {
+  while (point != nullptr) {
+    size_t left_size = get_size(point->left);
+    if (index == left_size) {
+      return point;
+    }
+    if (index < left_size) {
+      point = point->left;
+    } else {
+      index -= left_size + 1;
+      point = point->right;
+    }
+  }
+  return nullptr;
+}
+
+size_t tree_base_node::index_of(tree_base_node const* point) noexcept {
+  size_t index = get_size(point->left);
+  while (!point->is_end() && !point->parent->is_end()) {
+    if (point->parent->right == point) {
+      index += get_size(point->parent->left) + 1;
+    }
+    point = point->parent;
+  }
+  return index;
+}
+
+void tree_base_node::replace_child(tree_base_node* child, tree_base_node* replacement) noexcept {
+  if (left == child) {
+    left = replacement;
+  } else {
+    right = replacement;
+  }
+  if (replacement != nullptr) {
+    replacement->parent = this;
+  }
+}
+
+tree_base_node* tree_base_node::build(tree_base_node* const* first, tree_base_node* const* last) noexcept {
+  if (first == last) {
+    return nullptr;
   }
-  point->left = remove_min(point->left);
+  tree_base_node* const* middle = first + (last - first) / 2;
+  tree_base_node* point = *middle;
+  point->left = build(first, middle);
+  point->right = build(middle + 1, last);
   point->upd_kids();
-  return point->balance();
+  point->upd_height();
+  point->upd_size();
+  return point;
 }
 
 tree_base_node* tree_base_node::get_max() const noexcept {
@@ -1,9 +1,16 @@
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <iterator>
 #include <memory>
+#include <numeric>
 #include <optional>
+#include <tuple>
+#include <type_traits>
+#include <vector>
 
 namespace bimap_impl {
   struct left_tag;
@@ -12,6 +19,114 @@ namespace bimap_impl {
   template <typename T, typename Compare, typename Tag>
   struct tree;
 
+  // What diff reports for a left key whose pair differs between two maps.
+  enum class change_kind { inserted, removed, remapped };
+
+  template <typename Compare, typename = void>
+  struct is_transparent : std::false_type {};
+
+  template <typename Compare>
+  struct is_transparent<Compare, std::void_t<typename Compare::is_transparent>> : std::true_type {};
+
+  template <typename Compare>
+  inline constexpr bool is_transparent_v = is_transparent<Compare>::value;
+
+  template <typename Key, typename Value>
+  inline constexpr bool is_same_key_v = std::is_same_v<std::remove_cv_t<std::remove_reference_t<Key>>, Value>;
+
+  // Whether Key may be looked up on a side of Value keys ordered by Compare.
+  template <typename Key, typename Value, typename Compare>
+  inline constexpr bool is_key_v = is_same_key_v<Key, Value> || is_transparent_v<Compare>;
+
+  // Range inserts take anything std::get<0> and std::get<1> apply to.
+  template <typename InputIt>
+  using enable_if_pair_iterator_t =
+      std::void_t<decltype(std::tuple_size<typename std::iterator_traits<InputIt>::value_type>::value)>;
+
+  // Sorts the positions of count keys, where key(i) is the i-th one, and
+  // numbers runs of equal keys, returns the number of runs.
+  template <typename Key, typename Compare>
+  size_t sort_by_key(size_t count, Key const& key, Compare const& compare,
+                     std::vector<size_t>& order, std::vector<size_t>& groups) {
+    order.resize(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return compare(key(a), key(b));
+    });
+    groups.resize(count);
+    size_t run = 0;
+    for (size_t i = 0; i < count; ++i) {
+      if (i != 0 && compare(key(order[i - 1]), key(order[i]))) {
+        ++run;
+      }
+      groups[order[i]] = run;
+    }
+    return count == 0 ? 0 : run + 1;
+  }
+
+  inline void prefetch(void const* address) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(address);
+#else
+    (void)address;
+#endif
+  }
+
+  struct tree_base_node;
+
+#ifdef BIMAP_COMPACT_NODES
+  // Child link that keeps a few bits of its owner's height in the alignment
+  // bits of the pointer. Assigning a pointer or another link leaves them alone.
+  struct tagged_link {
+    static constexpr unsigned tag_bits = 3;
+    static constexpr std::uintptr_t tag_mask = (std::uintptr_t(1) << tag_bits) - 1;
+    static constexpr std::size_t alignment = std::size_t(1) << tag_bits;
+
+    tagged_link(tree_base_node* pointer, unsigned tag) noexcept
+        : bits(reinterpret_cast<std::uintptr_t>(pointer) | tag) {}
+
+    tagged_link(tagged_link const& other) noexcept = default;
+
+    tagged_link& operator=(tagged_link const& other) noexcept {
+      return *this = other.get();
+    }
+
+    tagged_link& operator=(tree_base_node* pointer) noexcept {
+      bits = reinterpret_cast<std::uintptr_t>(pointer) | (bits & tag_mask);
+      return *this;
+    }
+
+    operator tree_base_node*() const noexcept {
+      return get();
+    }
+
+    tree_base_node* operator->() const noexcept {
+      return get();
+    }
+
+    tree_base_node* get() const noexcept {
+      return reinterpret_cast<tree_base_node*>(bits & ~tag_mask);
+    }
+
+    unsigned get_tag() const noexcept {
+      return static_cast<unsigned>(bits & tag_mask);
+    }
+
+    void set_tag(unsigned tag) noexcept {
+      bits = (bits & ~tag_mask) | tag;
+    }
+
+  private:
+    std::uintptr_t bits;
+  };
+#endif
+
+  struct insert_position {
+    tree_base_node* parent;
+    tree_base_node* found;
+    bool to_left;
+  };
+
 
   struct tree_base_node {
     static size_t get_height(tree_base_node* point) noexcept;
@@ -20,6 +135,10 @@ namespace bimap_impl {
 
     void upd_height() noexcept;
 
+    static size_t get_size(tree_base_node* point) noexcept;
+
+    void upd_size() noexcept;
+
     void upd_left() noexcept;
 
     void upd_kids() noexcept;
@@ -32,7 +151,15 @@ namespace bimap_impl {
 
     tree_base_node* get_min() const noexcept;
 
-    static tree_base_node* remove_min(tree_base_node* point) noexcept;
+    static void link(insert_position const& position, tree_base_node* node) noexcept;
+
+    static void unlink(tree_base_node* node) noexcept;
+
+    static tree_base_node* select(tree_base_node* point, size_t index) noexcept;
+
+    static size_t index_of(tree_base_node const* point) noexcept;
+
+    static tree_base_node* build(tree_base_node* const* first, tree_base_node* const* last) noexcept;
 
     tree_base_node* get_max() const noexcept;
 
@@ -44,23 +171,74 @@ namespace bimap_impl {
     friend struct tree;
 
   private:
+    static void rebalance(tree_base_node* point) noexcept;
+
+    void replace_child(tree_base_node* child, tree_base_node* replacement) noexcept;
+
+    void detach() noexcept;
+
+#ifdef BIMAP_COMPACT_NODES
+    // The height is split between the tags of both links, and subtree sizes
+    // are 32-bit, so a node header takes 28 bytes instead of 40 on 64-bit
+    // targets and the value of the derived node fits into its tail padding.
+    // The tags need nodes aligned to tagged_link::alignment, which left asks for, so
+    // on 32-bit targets nodes are 8-byte aligned instead of 4.
+    size_t load_height() const noexcept {
+      return left.get_tag() | right.get_tag() << tagged_link::tag_bits;
+    }
+
+    void store_height(size_t value) noexcept {
+      left.set_tag(static_cast<unsigned>(value) & tagged_link::tag_mask);
+      right.set_tag(static_cast<unsigned>(value) >> tagged_link::tag_bits);
+    }
+
+    alignas(tagged_link::alignment) tagged_link left{nullptr, 1};
+    tagged_link right{nullptr, 0};
+    tree_base_node* parent{nullptr};
+    std::uint32_t size{1};
+#else
+    size_t load_height() const noexcept {
+      return height;
+    }
+
+    void store_height(size_t value) noexcept {
+      height = value;
+    }
+
     tree_base_node* left{nullptr};
     tree_base_node* right{nullptr};
     tree_base_node* parent{nullptr};
     size_t height{1};
+    size_t size{1};
+#endif
   };
 
 
+#ifdef BIMAP_COMPACT_NODES
+  static_assert(alignof(tree_base_node) >= tagged_link::alignment,
+                "tags of tagged_link must fit into the alignment bits of node pointers");
+#endif
+
+
   template <typename T, typename Tag>
   struct tree_node : tree_base_node {
     template <typename Arg>
     tree_node(Arg&& value_)
         : value_(std::forward<Arg>(value_)) {}
 
+    template <typename... Args>
+    tree_node(std::piecewise_construct_t, std::tuple<Args...> args)
+        : value_(std::make_from_tuple<T>(std::move(args))) {}
+
     T const& value() noexcept {
       return value_;
     }
 
+    // Only for nodes that are not linked into a tree.
+    T& mutable_value() noexcept {
+      return value_;
+    }
+
   private:
     T value_;
   };
@@ -73,6 +251,11 @@ namespace bimap_impl {
     bimap_node(ArgLeft&& left, ArgRight&& right)
         : tree_node<Left, left_tag>(std::forward<ArgLeft>(left)),
           tree_node<Right, right_tag>(std::forward<ArgRight>(right)) {}
+
+    template <typename... ArgsLeft, typename... ArgsRight>
+    bimap_node(std::piecewise_construct_t, std::tuple<ArgsLeft...> left, std::tuple<ArgsRight...> right)
+        : tree_node<Left, left_tag>(std::piecewise_construct, std::move(left)),
+          tree_node<Right, right_tag>(std::piecewise_construct, std::move(right)) {}
   };
 
 
@@ -88,15 +271,16 @@ namespace bimap_impl {
     tree(Compare&& compare) noexcept
         : compare(std::move(compare)) {}
 
-    node_t* find(T const& key) const {
-      node_t* point = static_cast<node_t*>(fake.left);
+    template <typename Key>
+    node_t* find(Key const& key) const {
+      node_t* point = to_node(fake.left);
       while (point != nullptr) {
         if (compare(key, point->value())) {
-          point = static_cast<node_t*>(point->left);
+          point = to_node(point->left);
           continue;
         }
         if (compare(point->value(), key)) {
-          point = static_cast<node_t*>(point->right);
+          point = to_node(point->right);
           continue;
         }
         break;
@@ -104,22 +288,213 @@ namespace bimap_impl {
       return point;
     }
 
+    // Calls found with the node of every key of [first, last) in order, or
+    // with nullptr for the missing ones. Searches run in groups: every round
+    // moves each unfinished search of the group one level down and prefetches
+    // its next node, so the cache misses of different searches overlap.
+    template <typename ForwardIt, typename Found>
+    void find_batch(ForwardIt first, ForwardIt last, Found&& found) const {
+      static constexpr size_t group_size = 16;
+      node_base_t* points[group_size];
+      node_t* results[group_size];
+      while (first != last) {
+        ForwardIt group = first;
+        size_t count = 0;
+        for (; first != last && count < group_size; ++first, ++count) {
+          points[count] = fake.left;
+          results[count] = nullptr;
+        }
+
+        for (bool active = true; active;) {
+          active = false;
+          ForwardIt key = group;
+          for (size_t i = 0; i < count; ++i, ++key) {
+            if (points[i] == nullptr) {
+              continue;
+            }
+            node_t* point = to_node(points[i]);
+            if (compare(*key, point->value())) {
+              points[i] = point->left;
+            } else if (compare(point->value(), *key)) {
+              points[i] = point->right;
+            } else {
+              results[i] = point;
+              points[i] = nullptr;
+              continue;
+            }
+            if (points[i] != nullptr) {
+              prefetch(&to_node(points[i])->value());
+              active = true;
+            }
+          }
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+          found(results[i]);
+        }
+      }
+    }
+
+    template <typename Key>
+    insert_position find_position(Key const& key) const {
+      insert_position position{const_cast<node_base_t*>(&fake), nullptr, true};
+      node_base_t* point = fake.left;
+      while (point != nullptr) {
+        if (compare(key, static_cast<node_t*>(point)->value())) {
+          position.parent = point;
+          position.to_left = true;
+          point = point->left;
+        } else if (compare(static_cast<node_t*>(point)->value(), key)) {
+          position.parent = point;
+          position.to_left = false;
+          point = point->right;
+        } else {
+          position.found = point;
+          break;
+        }
+      }
+      return position;
+    }
+
+    // Checks whether key belongs right before hint or right after it, which
+    // costs a couple of comparisons instead of a descent from the root.
+    template <typename Key>
+    insert_position find_position(node_base_t* hint, Key const& key) const {
+      if (hint->is_end() || compare(key, static_cast<node_t*>(hint)->value())) {
+        node_base_t* before = prev(hint);
+        if (before == nullptr || compare(static_cast<node_t*>(before)->value(), key)) {
+          return hint->left == nullptr ? insert_position{hint, nullptr, true}
+                                       : insert_position{before, nullptr, false};
+        }
+      } else if (!compare(static_cast<node_t*>(hint)->value(), key)) {
+        return insert_position{nullptr, hint, false};
+      } else {
+        node_base_t* after = next(hint);
+        if (after->is_end() || compare(key, static_cast<node_t*>(after)->value())) {
+          return hint->right == nullptr ? insert_position{hint, nullptr, false}
+                                        : insert_position{after, nullptr, true};
+        }
+      }
+      return find_position(key);
+    }
+
     node_t* insert(node_t* node) {
-      fake.left = static_cast<node_base_t*>(insert_impl(static_cast<node_t*>(fake.left), node));
-      fake.upd_left();
-      check_invariant(static_cast<node_t*>(fake.left));
+      insert_position position = find_position(node->value());
+      return position.found == nullptr ? insert(position, node) : static_cast<node_t*>(position.found);
+    }
+
+    node_t* insert(insert_position const& position, node_t* node) noexcept {
+      assert(position.found == nullptr);
+      node_base_t::link(position, static_cast<node_base_t*>(node));
+      check_invariant(to_node(fake.left));
       return node;
     }
 
     node_base_t* remove(node_t* src) {
       node_base_t* src_next = next(static_cast<node_base_t*>(src));
-      fake.left = static_cast<node_base_t*>(remove_impl(static_cast<node_t*>(fake.left), src));
-      fake.upd_left();
-      check_invariant(static_cast<node_t*>(fake.left));
+      node_base_t::unlink(static_cast<node_base_t*>(src));
+      check_invariant(to_node(fake.left));
       assert(lower_bound(src->value()) == src_next);
       return src_next;
     }
 
+    // Takes a node out without the checks of remove, to undo an insert.
+    void unlink(node_t* src) noexcept {
+      node_base_t::unlink(static_cast<node_base_t*>(src));
+    }
+
+    // For runs of equal keys numbered by sort_by_key over node_at(i), marks
+    // the ones whose key is in the tree.
+    template <typename NodeAt>
+    void mark_existing(NodeAt const& node_at, std::vector<size_t> const& order,
+                       std::vector<size_t> const& groups, std::vector<bool>& taken) const {
+      for (size_t i = 0; i < order.size(); ++i) {
+        size_t group = groups[order[i]];
+        if ((i == 0 || groups[order[i - 1]] != group) && find(node_at(order[i])->value()) != nullptr) {
+          taken[group] = true;
+        }
+      }
+    }
+
+    // Merges the nodes of the tree with the accepted ones of node_at(i),
+    // taken in the sorted order, into one sorted sequence for assign.
+    template <typename NodeAt>
+    void merge_sorted(NodeAt const& node_at, std::vector<size_t> const& order,
+                      std::vector<bool> const& accepted, std::vector<node_base_t*>& sorted) const {
+      std::vector<node_base_t*> added;
+      for (size_t index : order) {
+        if (accepted[index]) {
+          added.push_back(static_cast<node_base_t*>(node_at(index)));
+        }
+      }
+      std::vector<node_base_t*> existing;
+      for (node_base_t* point = get_begin(); point != get_end(); point = next(point)) {
+        existing.push_back(point);
+      }
+      sorted.resize(existing.size() + added.size());
+      std::merge(existing.begin(), existing.end(), added.begin(), added.end(), sorted.begin(),
+                 [this](node_base_t* a, node_base_t* b) {
+                   return compare(to_node(a)->value(), to_node(b)->value());
+                 });
+    }
+
+    void assign(node_base_t* const* first, node_base_t* const* last) noexcept {
+      fake.left = node_base_t::build(first, last);
+      fake.upd_left();
+      check_invariant(to_node(fake.left));
+    }
+
+    template <typename Destroy>
+    void clear(Destroy&& destroy) noexcept {
+      node_base_t* point = fake.left;
+      while (point != nullptr) {
+        if (point->left != nullptr) {
+          point = point->left;
+          continue;
+        }
+        if (point->right != nullptr) {
+          point = point->right;
+          continue;
+        }
+        node_base_t* parent = point->parent;
+        if (parent->left == point) {
+          parent->left = nullptr;
+        } else {
+          parent->right = nullptr;
+        }
+        destroy(static_cast<node_t*>(point));
+        point = parent->is_end() ? nullptr : parent;
+      }
+    }
+
+    void reset() noexcept {
+      fake.left = nullptr;
+    }
+
+    node_base_t* nth(size_t index) const noexcept {
+      node_base_t* point = node_base_t::select(fake.left, index);
+      return point != nullptr ? point : get_end();
+    }
+
+    template <typename Key>
+    size_t rank(Key const& key) const {
+      size_t result = 0;
+      node_base_t* point = fake.left;
+      while (point != nullptr) {
+        if (!compare(static_cast<node_t*>(point)->value(), key)) {
+          point = point->left;
+        } else {
+          result += node_base_t::get_size(point->left) + 1;
+          point = point->right;
+        }
+      }
+      return result;
+    }
+
+    static size_t index_of(node_base_t const* point) noexcept {
+      return node_base_t::index_of(point);
+    }
+
     node_base_t* get_begin() const noexcept {
       return fake.get_min();
     }
@@ -156,7 +531,8 @@ namespace bimap_impl {
       return parent;
     }
 
-    node_base_t* lower_bound(T const& key) const {
+    template <typename Key>
+    node_base_t* lower_bound(Key const& key) const {
       node_base_t* result = const_cast<node_base_t*>(&fake);
       node_base_t* point = fake.left;
       while (point != nullptr) {
@@ -170,7 +546,8 @@ namespace bimap_impl {
       return result;
     }
 
-    node_base_t* upper_bound(T const& key) const {
+    template <typename Key>
+    node_base_t* upper_bound(Key const& key) const {
       node_base_t* point = lower_bound(key);
       return point != &fake && !compare(key, static_cast<node_t*>(point)->value()) ? next(point) : point;
     }
@@ -193,48 +570,8 @@ namespace bimap_impl {
     }
 
   private:
-    node_t* insert_impl(node_t* point, node_t* node) {
-      if (point == nullptr) {
-        return node;
-      }
-      if (compare(node->value(), point->value())) {
-        point->left = static_cast<node_base_t*>(insert_impl(static_cast<node_t*>(point->left), node));
-        point->upd_kids();
-        return static_cast<node_t*>(point->balance());
-      }
-      if (compare(point->value(), node->value())) {
-        point->right = static_cast<node_base_t*>(insert_impl(static_cast<node_t*>(point->right), node));
-        point->upd_kids();
-      }
-      return static_cast<node_t*>(point->balance());
-    }
-
-    node_t* remove_impl(node_t* point, node_t* node) {
-      if (point == nullptr) {
-        return nullptr;
-      }
-      if (compare(node->value(), point->value())) {
-        point->left = static_cast<node_base_t*>(remove_impl(static_cast<node_t*>(point->left), node));
-        point->upd_kids();
-        return static_cast<node_t*>(point->balance());
-      }
-      if (compare(point->value(), node->value())) {
-        point->right = static_cast<node_base_t*>(remove_impl(static_cast<node_t*>(point->right), node));
-        point->upd_kids();
-        return static_cast<node_t*>(point->balance());
-      }
-
-      node_t* left = static_cast<node_t*>(point->left);
-      node_t* right = static_cast<node_t*>(point->right);
-      if (right == nullptr) {
-        return left;
-      }
-      node_t* minimal = static_cast<node_t*>(right->get_min());
-      minimal->right = node_base_t::remove_min(right);
-      minimal->left = static_cast<node_base_t*>(left);
-      minimal->parent = point->parent;
-      minimal->upd_kids();
-      return static_cast<node_t*>(minimal->balance());
+    static node_t* to_node(node_base_t* point) noexcept {
+      return static_cast<node_t*>(point);
     }
 
     void check_invariant(node_t* point) {
@@ -245,16 +582,19 @@ namespace bimap_impl {
 
         if (point->left != nullptr) {
           assert(static_cast<node_t*>(point->left->parent) == point);
-          assert(compare(static_cast<node_t*>(point->left)->value(), point->value()));
-          check_invariant(static_cast<node_t*>(point->left));
+          assert(compare(to_node(point->left)->value(), point->value()));
+          check_invariant(to_node(point->left));
         }
 
         if (point->right != nullptr) {
           assert(static_cast<node_t*>(point->right->parent) == point);
-          assert(compare(point->value(), static_cast<node_t*>(point->right)->value()));
-          check_invariant(static_cast<node_t*>(point->right));
+          assert(compare(point->value(), to_node(point->right)->value()));
+          check_invariant(to_node(point->right));
         }
 
+        assert(node_base_t::get_height(point) == std::max(node_base_t::get_height(point->left),
+                                         node_base_t::get_height(point->right)) + 1);
+        assert(point->size == node_base_t::get_size(point->left) + node_base_t::get_size(point->right) + 1);
         assert(-1 <= point->get_balance());
         assert(point->get_balance() <= 1);
       #endif
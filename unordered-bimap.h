@@ -0,0 +1,23 @@
+#pragma once
+
+#include "indexed-bimap.h"
+#include <functional>
+#include <memory>
+#include <utility>
+
+// bimap whose sides are hash tables instead of trees, for maps that are only
+// searched by exact key. Lookups, inserts and erases take O(1) on average
+// and pairs are iterated in no particular order. As in bimap every pair is
+// a single node linked into both tables, so flip is O(1) as well. This is
+// indexed_bimap with a hashed index on both sides; custom function objects
+// are passed as hashed_index policies.
+template <typename Left, typename Right,
+          typename HashLeft = std::hash<Left>,
+          typename HashRight = std::hash<Right>,
+          typename EqualLeft = std::equal_to<Left>,
+          typename EqualRight = std::equal_to<Right>,
+          typename Allocator = std::allocator<std::pair<Left, Right>>>
+using unordered_bimap = indexed_bimap<Left, Right,
+                                      hashed_index<HashLeft, EqualLeft>,
+                                      hashed_index<HashRight, EqualRight>,
+                                      Allocator>;
@@ -0,0 +1,230 @@
+#pragma once
+
+#include "tree.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace bimap_impl {
+  template <typename T, typename Compare>
+  struct has_wide_index
+      : std::bool_constant<std::is_integral_v<T> && !std::is_same_v<T, bool> && sizeof(T) <= 8 &&
+                           (std::is_same_v<Compare, std::less<T>> || std::is_same_v<Compare, std::less<>> ||
+                            std::is_same_v<Compare, std::greater<T>> ||
+                            std::is_same_v<Compare, std::greater<>>)> {};
+
+  template <typename T, typename Compare>
+  inline constexpr bool has_wide_index_v = has_wide_index<T, Compare>::value;
+
+  // Keys of a block are sorted, so the lanes that compare less form a run of
+  // low bits in the mask and their number is the count of trailing ones.
+  inline unsigned trailing_ones(unsigned mask) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_ctz(~mask));
+#else
+    unsigned count = 0;
+    for (; mask & 1; mask >>= 1) {
+      ++count;
+    }
+    return count;
+#endif
+  }
+
+  // Number of the sorted keys of a 64 byte block that are less than key.
+  inline unsigned count_less(int32_t const* keys, int32_t key) noexcept {
+#if defined(__AVX2__)
+    __m256i x = _mm256_set1_epi32(key);
+    __m256i low = _mm256_cmpgt_epi32(x, _mm256_load_si256(reinterpret_cast<__m256i const*>(keys)));
+    __m256i high = _mm256_cmpgt_epi32(x, _mm256_load_si256(reinterpret_cast<__m256i const*>(keys + 8)));
+    return trailing_ones(static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(low))) |
+                         static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(high))) << 8);
+#elif defined(__SSE2__)
+    __m128i x = _mm_set1_epi32(key);
+    __m128i less[4];
+    for (size_t i = 0; i < 4; ++i) {
+      less[i] = _mm_cmpgt_epi32(x, _mm_load_si128(reinterpret_cast<__m128i const*>(keys + i * 4)));
+    }
+    __m128i packed = _mm_packs_epi16(_mm_packs_epi32(less[0], less[1]), _mm_packs_epi32(less[2], less[3]));
+    return trailing_ones(static_cast<unsigned>(_mm_movemask_epi8(packed)));
+#else
+    unsigned count = 0;
+    for (size_t i = 0; i < 16; ++i) {
+      count += keys[i] < key;
+    }
+    return count;
+#endif
+  }
+
+  inline unsigned count_less(int64_t const* keys, int64_t key) noexcept {
+#if defined(__AVX2__)
+    __m256i x = _mm256_set1_epi64x(key);
+    __m256i low = _mm256_cmpgt_epi64(x, _mm256_load_si256(reinterpret_cast<__m256i const*>(keys)));
+    __m256i high = _mm256_cmpgt_epi64(x, _mm256_load_si256(reinterpret_cast<__m256i const*>(keys + 4)));
+    return trailing_ones(static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(low))) |
+                         static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(high))) << 4);
+#elif defined(__SSE4_2__)
+    __m128i x = _mm_set1_epi64x(key);
+    unsigned mask = 0;
+    for (size_t i = 0; i < 4; ++i) {
+      __m128i less = _mm_cmpgt_epi64(x, _mm_load_si128(reinterpret_cast<__m128i const*>(keys + i * 2)));
+      mask |= static_cast<unsigned>(_mm_movemask_pd(_mm_castsi128_pd(less))) << (i * 2);
+    }
+    return trailing_ones(mask);
+#else
+    unsigned count = 0;
+    for (size_t i = 0; i < 8; ++i) {
+      count += keys[i] < key;
+    }
+    return count;
+#endif
+  }
+
+  // Read-only copy of the keys of one tree for integral keys ordered by
+  // std::less or std::greater. Keys are mapped to signed integers whose
+  // natural order is the order of the tree and stored in a static B-tree of
+  // 64 byte blocks: block k holds a sorted run of keys, and the keys between
+  // its i-th and (i + 1)-th are in the subtree of block k * (width + 1) + i + 1.
+  // One step of a search compares the key with a whole block at once. The
+  // last blocks are padded with the largest value, which sorts after every key.
+  template <typename T, typename Compare, typename Tag>
+  struct wide_index {
+  private:
+    using node_t = tree_node<T, Tag>;
+    using node_base_t = tree_base_node;
+    using tree_t = tree<T, Compare, Tag>;
+    using encoded_t = std::conditional_t<sizeof(T) <= 4, int32_t, int64_t>;
+
+    static constexpr size_t width = 64 / sizeof(encoded_t);
+    static constexpr bool reversed = std::is_same_v<Compare, std::greater<T>> ||
+                                     std::is_same_v<Compare, std::greater<>>;
+
+    struct alignas(64) block {
+      encoded_t keys[width];
+    };
+
+  public:
+    wide_index(tree_t const& tree, size_t size)
+        : blocks((size + width - 1) / width), nodes(blocks.size() * width, tree.get_end()),
+          end(tree.get_end()) {
+      node_base_t* point = tree.get_begin();
+      place(0, point);
+    }
+
+    template <typename Key>
+    node_base_t* lower_bound(Key const& key) const {
+      if constexpr (std::is_same_v<Key, T>) {
+        encoded_t x = encode(key);
+        return search([x](block const& b) { return count_less(b.keys, x); });
+      } else {
+        return search([&key](block const& b) {
+          unsigned count = 0;
+          for (encoded_t value : b.keys) {
+            count += Compare()(decode(value), key);
+          }
+          return count;
+        });
+      }
+    }
+
+    template <typename Key>
+    node_base_t* upper_bound(Key const& key) const {
+      if constexpr (std::is_same_v<Key, T>) {
+        encoded_t x = encode(key);
+        if (x == std::numeric_limits<encoded_t>::max()) {
+          return end;
+        }
+        return search([x](block const& b) { return count_less(b.keys, x + 1); });
+      } else {
+        return search([&key](block const& b) {
+          unsigned count = 0;
+          for (encoded_t value : b.keys) {
+            count += !Compare()(key, decode(value));
+          }
+          return count;
+        });
+      }
+    }
+
+    template <typename Key>
+    node_base_t* find(Key const& key) const {
+      node_base_t* point = lower_bound(key);
+      if (point == end || Compare()(key, static_cast<node_t*>(point)->value())) {
+        return end;
+      }
+      return point;
+    }
+
+  private:
+    static encoded_t encode(T value) noexcept {
+      using unsigned_t = std::make_unsigned_t<encoded_t>;
+      encoded_t result;
+      if constexpr (std::is_signed_v<T> || sizeof(T) < sizeof(encoded_t)) {
+        result = static_cast<encoded_t>(value);
+      } else {
+        result = static_cast<encoded_t>(static_cast<unsigned_t>(value) ^
+                                        (unsigned_t(1) << (sizeof(encoded_t) * 8 - 1)));
+      }
+      return reversed ? ~result : result;
+    }
+
+    static T decode(encoded_t value) noexcept {
+      using unsigned_t = std::make_unsigned_t<encoded_t>;
+      value = reversed ? ~value : value;
+      if constexpr (std::is_signed_v<T> || sizeof(T) < sizeof(encoded_t)) {
+        return static_cast<T>(value);
+      } else {
+        return static_cast<T>(static_cast<unsigned_t>(value) ^
+                              (unsigned_t(1) << (sizeof(encoded_t) * 8 - 1)));
+      }
+    }
+
+    static size_t child(size_t k, size_t i) noexcept {
+      return k * (width + 1) + i + 1;
+    }
+
+    // In-order walk over the blocks, taking keys from the tree and padding
+    // once it is exhausted.
+    void place(size_t k, node_base_t*& point) {
+      if (k >= blocks.size()) {
+        return;
+      }
+      for (size_t i = 0; i < width; ++i) {
+        place(child(k, i), point);
+        if (point->is_end()) {
+          blocks[k].keys[i] = std::numeric_limits<encoded_t>::max();
+        } else {
+          blocks[k].keys[i] = encode(static_cast<node_t*>(point)->value());
+          nodes[k * width + i] = point;
+          point = tree_t::next(point);
+        }
+      }
+      place(child(k, width), point);
+    }
+
+    // count(b) is the number of keys of block b that go before the result.
+    // The result is the first key for which that fails on the way down.
+    template <typename Count>
+    node_base_t* search(Count count) const {
+      node_base_t* result = end;
+      for (size_t k = 0; k < blocks.size();) {
+        size_t i = count(blocks[k]);
+        if (i < width) {
+          result = nodes[k * width + i];
+        }
+        k = child(k, i);
+      }
+      return result;
+    }
+
+    std::vector<block> blocks;
+    std::vector<node_base_t*> nodes;
+    node_base_t* end;
+  };
+}